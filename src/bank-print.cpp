@@ -0,0 +1,108 @@
+#include <fmt/core.h>
+#include "bank-print.h"
+
+void printInstrument(FILE* out, GBAInstrument const& instrument, uint32_t instrIndex)
+{
+	fmt::print(out, "------ instrument {:02x} ------\n", instrIndex+1);
+	fmt::print(out, "\tsample length: {} bytes\n", instrument.header.sampleLength);
+	fmt::print(out, "\tsample loop start:  {}\n", instrument.header.sampleLoopStart);
+	fmt::print(out, "\tsample loop length: {}\n", instrument.header.sampleLoopLength);
+	fmt::print(out, "\tsample volume:      {}\n", instrument.header.sampleVolume);
+	fmt::print(out, "\tsample panning:     {}\n", instrument.header.samplePanning);
+	fmt::print(out, "\tsample finetune:    {}\n", instrument.header.sampleFinetune);
+	fmt::print(out, "\tsample relative note #: {}\n", instrument.header.sampleRelativeNoteNumber);
+	fmt::print(out, "\tvolume fadeout:     {}\n", instrument.header.volumeFadeout);
+	fmt::print(out, "\tunknown bytes:      {:02x} {:02x}\n", instrument.header.unknownBytes[0], instrument.header.unknownBytes[1]);
+	{
+		fmt::print(out, "\t-- volume envelope --\n");
+		fmt::print(out, "\t\tpoint count:      {}\n", instrument.header.volumeEnvelope.pointCount);
+		fmt::print(out, "\t\tsustain point?    {}\n", instrument.header.volumeEnvelope.maybeSustainPoint);
+		fmt::print(out, "\t\tloop start point? {}\n", instrument.header.volumeEnvelope.maybeLoopStartPoint);
+		fmt::print(out, "\t\tloop end point?   {}\n", instrument.header.volumeEnvelope.maybeLoopEndPoint);
+		if (instrument.header.volumeEnvelope.pointCount != 0)
+		{
+			fmt::print(out, "\t\tpoints:");
+			for (int j = 0; j < instrument.header.volumeEnvelope.pointCount; ++j)
+			{
+				fmt::print(out, " [{}, {}],",
+					instrument.header.volumeEnvelope.points[j].x,
+					instrument.header.volumeEnvelope.points[j].y);
+			}
+			fmt::print(out, "\n");
+		}
+	}
+	{
+		fmt::print(out, "\t-- panning envelope --\n");
+		fmt::print(out, "\t\tpoint count:      {}\n", instrument.header.panningEnvelope.pointCount);
+		fmt::print(out, "\t\tsustain point?    {}\n", instrument.header.panningEnvelope.maybeSustainPoint);
+		fmt::print(out, "\t\tloop start point? {}\n", instrument.header.panningEnvelope.maybeLoopStartPoint);
+		fmt::print(out, "\t\tloop end point?   {}\n", instrument.header.panningEnvelope.maybeLoopEndPoint);
+		if (instrument.header.panningEnvelope.pointCount != 0)
+		{
+			fmt::print(out, "\t\tpoints:");
+			for (int j = 0; j < instrument.header.panningEnvelope.pointCount; ++j)
+			{
+				fmt::print(out, " [{}, {}],",
+					instrument.header.panningEnvelope.points[j].x,
+					instrument.header.panningEnvelope.points[j].y);
+			}
+			fmt::print(out, "\n");
+		}
+	}
+	fmt::print(out, "\n");
+}
+
+void printSong(FILE* out, GBASong const& song, size_t songIndex)
+{
+	fmt::print(out, "------ song {:02x} ------\n", songIndex);
+
+	fmt::print(out, "\tchannel count: {}\n", song.header.channelCount);
+	fmt::print(out, "\tsong length:   {}\n", song.header.songLength);
+	fmt::print(out, "\tloop point:    {}\n", song.header.loopPoint);
+	fmt::print(out, "\tpattern count: {}\n", song.header.patternCount);
+	fmt::print(out, "\ttickrate:      {} ticks/row\n", song.header.tickrate);
+	fmt::print(out, "\ttempo:         {} beats/min\n", song.header.tempo);
+
+	fmt::print(out, "\tpattern order: [");
+	for (uint8_t patternInstance : song.patternOrder)
+	{
+		fmt::print(out, " {:02x}", patternInstance);
+	}
+	fmt::print(out, " ]\n");
+
+	for (int patternIndex = 0; patternIndex < song.header.patternCount; ++patternIndex)
+	{
+		fmt::print(out, "\t-- pattern {:02x} --\n", patternIndex);
+
+		SharedPattern const& pattern = song.patterns[patternIndex];
+
+		for (uint32_t rowIndex = 0; rowIndex < pattern.rowCount(); ++rowIndex)
+		{
+			fmt::print(out, "\t\t{:02x} |", rowIndex);
+
+			Span<SharedCell const> const row = pattern.row(rowIndex);
+
+			char const* notes[] = {
+				"C-", "C#", "D-",
+				"D#", "E-", "F-",
+				"F#", "G-", "G#",
+				"A-", "A#", "B-",
+			};
+
+			for (int i = 0; i < song.header.channelCount; ++i)
+			{
+				SharedCell const& cell = row[i];
+				uint8_t const note = (cell.note-1);
+				fmt::print(out, cell.note ? " {}{}" : " ---", notes[note%12], note/12);
+				fmt::print(out, cell.inst   ? " {:02x}" : " --", cell.inst);
+				fmt::print(out, cell.vol    ? " {:02x}" : " --", cell.vol);
+				fmt::print(out, cell.effect ? " {:02x}" : " --", cell.effect);
+				fmt::print(out, cell.param  ? " {:02x}" : " --", cell.param);
+				fmt::print(out, " |");
+			}
+
+			fmt::print(out, "\n");
+		}
+	}
+	fmt::print(out, "\n");
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include "common-gba.h"
+
+// the human-readable listings gbaprint produces. indices are only used for the headings.
+void printInstrument(FILE* out, GBAInstrument const& instrument, uint32_t instrIndex);
+void printSong(FILE* out, GBASong const& song, size_t songIndex);
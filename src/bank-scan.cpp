@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <cstring>
+#include "bank-scan.h"
+#include "misc.h"
+#include "thread-pool.h"
+#include "trace.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define ESGBA_SCAN_SSE2 1
+#if defined(__GNUC__) || defined(__clang__)
+#define ESGBA_SCAN_AVX2 1
+#endif
+#endif
+
+namespace
+{
+	bool isSignature(uint8_t const* p)
+	{
+		return p[0] == 0x21 && p[1] == 0x01 && p[2] != 0 && p[3] != 0;
+	}
+
+	size_t scanScalar(uint8_t const* data, size_t addr, size_t end, std::vector<uint32_t>& candidates)
+	{
+		for (; addr+4 <= end; addr += 4)
+		{
+			if (isSignature(data+addr))
+				candidates.push_back(addr);
+		}
+		return addr;
+	}
+
+	void pushMatches(int bits, size_t addr, std::vector<uint32_t>& candidates)
+	{
+		while (bits)
+		{
+			candidates.push_back(addr + 4*__builtin_ctz(bits));
+			bits &= bits-1;
+		}
+	}
+
+#if ESGBA_SCAN_SSE2
+	// each 32-bit lane is one candidate header: the low half must be 0x0121, and neither count byte may be zero
+	size_t scanSSE2(uint8_t const* data, size_t addr, size_t end, std::vector<uint32_t>& candidates)
+	{
+		__m128i const zero = _mm_setzero_si128();
+		__m128i const idMask = _mm_set1_epi32(0x0000ffff);
+		__m128i const countMask = _mm_set1_epi32(int(0xffff0000));
+		__m128i const id = _mm_set1_epi32(0x0121);
+
+		for (; addr+16 <= end; addr += 16)
+		{
+			__m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data+addr));
+			__m128i const idMatches = _mm_cmpeq_epi32(_mm_and_si128(v, idMask), id);
+			__m128i const zeroCounts = _mm_and_si128(_mm_cmpeq_epi8(v, zero), countMask);
+			__m128i const countsValid = _mm_cmpeq_epi32(zeroCounts, zero);
+			int const bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(idMatches, countsValid)));
+			pushMatches(bits, addr, candidates);
+		}
+		return addr;
+	}
+#endif
+
+#if ESGBA_SCAN_AVX2
+	__attribute__((target("avx2")))
+	size_t scanAVX2(uint8_t const* data, size_t addr, size_t end, std::vector<uint32_t>& candidates)
+	{
+		__m256i const zero = _mm256_setzero_si256();
+		__m256i const idMask = _mm256_set1_epi32(0x0000ffff);
+		__m256i const countMask = _mm256_set1_epi32(int(0xffff0000));
+		__m256i const id = _mm256_set1_epi32(0x0121);
+
+		for (; addr+32 <= end; addr += 32)
+		{
+			__m256i const v = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data+addr));
+			__m256i const idMatches = _mm256_cmpeq_epi32(_mm256_and_si256(v, idMask), id);
+			__m256i const zeroCounts = _mm256_and_si256(_mm256_cmpeq_epi8(v, zero), countMask);
+			__m256i const countsValid = _mm256_cmpeq_epi32(zeroCounts, zero);
+			int const bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_and_si256(idMatches, countsValid)));
+			pushMatches(bits, addr, candidates);
+		}
+		return addr;
+	}
+
+	bool const kHasAVX2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+char const* bankScanStageName(BankScanStage stage)
+{
+	switch (stage)
+	{
+		case BankScanStage::Signature:   return "signature";
+		case BankScanStage::SongOffsets: return "song offsets";
+		case BankScanStage::Instruments: return "instruments";
+		case BankScanStage::Overlap:     return "instrument/song overlap";
+		case BankScanStage::SongOrder:   return "song order";
+		case BankScanStage::Songs:       return "songs";
+		case BankScanStage::Accepted:    return "accepted";
+	}
+	return "???";
+}
+
+void BankScanStats::merge(BankScanStats const& other)
+{
+	this->positions += other.positions;
+	for (int i = 0; i < kBankScanStageCount; ++i)
+	{
+		this->reached[i] += other.reached[i];
+	}
+}
+
+void findBankCandidates(ByteView rom, size_t begin, size_t end, std::vector<uint32_t>& candidates)
+{
+	if (end > rom.size)
+		end = rom.size;
+
+	size_t addr = (begin+3) & ~size_t(3);
+	if (addr >= end)
+		return;
+
+#if ESGBA_SCAN_AVX2
+	if (kHasAVX2)
+		addr = scanAVX2(rom.data, addr, end, candidates);
+#endif
+#if ESGBA_SCAN_SSE2
+	addr = scanSSE2(rom.data, addr, end, candidates);
+#endif
+	scanScalar(rom.data, addr, end, candidates);
+}
+
+BankScanStage validateMusicBank(ByteView rom, uint32_t baseAddr)
+{
+	size_t const fileLength = rom.size;
+
+	ByteReader reader(rom, baseAddr);
+
+	// each stage is its own trace scope, so a trace shows which checks the time goes on
+	gba_musicbank_header_t header;
+	{
+		TRACE_SCOPE("validate signature");
+		header = reader.read<gba_musicbank_header_t>();
+		if (reader.overrun)
+			return BankScanStage::Signature;
+		if (header.version != 0x0121)
+			return BankScanStage::Signature;
+		if (header.instrumentCount == 0)
+			return BankScanStage::Signature;
+		if (header.songCount == 0)
+			return BankScanStage::Signature;
+	}
+
+	std::vector<uint32_t> songOffsets;
+	{
+		TRACE_SCOPE("validate song offsets");
+		songOffsets = reader.readArray<uint32_t>(header.songCount);
+		if (reader.overrun)
+			return BankScanStage::SongOffsets;
+	}
+
+	{
+		TRACE_SCOPE_ARG("validate instruments", "instruments", header.instrumentCount);
+		bool instsValid = true;
+		for (int inst = 0; instsValid && inst < header.instrumentCount; ++inst)
+		{
+			gba_instrument_header_t const instHeader = reader.read<gba_instrument_header_t>();
+			instsValid &= !reader.overrun;
+			instsValid &= (instHeader.volumeEnvelope.pointCount <= 12);
+			instsValid &= (instHeader.panningEnvelope.pointCount <= 12);
+
+			reader.skip(instHeader.sampleLength);
+			reader.align(4);
+		}
+		if (!instsValid)
+			return BankScanStage::Instruments;
+	}
+
+	{
+		TRACE_SCOPE("validate overlap");
+		// instruments shouldn't overshoot and overlap the songs
+		if (reader.pos-baseAddr > songOffsets[0])
+			return BankScanStage::Overlap;
+	}
+
+	{
+		TRACE_SCOPE("validate song order");
+		// song offsets should be sorted
+		for (int i = 1; i < header.songCount; ++i)
+		{
+			if (songOffsets[i-1] >= songOffsets[i])
+				return BankScanStage::SongOrder;
+		}
+	}
+
+	{
+		TRACE_SCOPE_ARG("validate songs", "songs", header.songCount);
+		bool songsValid = true;
+		for (int song = 0; songsValid && song < header.songCount; ++song)
+		{
+			// songs should be 4byte aligned
+			songsValid &= (songOffsets[song] == (songOffsets[song] & 0xfffffffcu));
+			songsValid &= (songOffsets[song] < fileLength);
+
+			reader.seek(baseAddr+songOffsets[song]);
+
+			gba_song_header_t const songHeader = reader.read<gba_song_header_t>();
+			songsValid &= !reader.overrun;
+			songsValid &= (songHeader.channelCount != 0);
+			songsValid &= (songHeader.songLength != 0);
+			songsValid &= (songHeader.patternCount != 0);
+			songsValid &= (songHeader.tickrate != 0);
+			songsValid &= (songHeader.tempo != 0);
+
+			reader.align(4);
+			uint8_t const* patternOrder = reader.take(songHeader.songLength);
+			songsValid &= (patternOrder != nullptr);
+
+			for (int i = 0; patternOrder && i < songHeader.songLength; ++i)
+				songsValid &= (patternOrder[i] < songHeader.patternCount);
+		}
+		if (!songsValid)
+			return BankScanStage::Songs;
+	}
+
+	return BankScanStage::Accepted;
+}
+
+std::vector<FoundBank> scanForMusicBanks(ByteView rom, size_t begin, size_t end, BankScanStats* stats)
+{
+	if (end > rom.size)
+		end = rom.size;
+
+	std::vector<uint32_t> candidates;
+	{
+		TRACE_SCOPE_ARG("find candidates", "bytes", end > begin ? end-begin : 0);
+		findBankCandidates(rom, begin, end, candidates);
+	}
+	TRACE_SCOPE_ARG("validate candidates", "candidates", candidates.size());
+
+	// the chunk is read once through, and each candidate is a jump back into it to validate
+	countAdd(Counter::BytesTouched, end > begin ? end-begin : 0);
+	countAdd(Counter::DiscontiguousReads, candidates.size());
+
+	BankScanStats localStats;
+	if (begin < end)
+	{
+		size_t const firstAddr = (begin+3) & ~size_t(3);
+		localStats.positions = (end > firstAddr) ? (end-firstAddr+3)/4 : 0;
+	}
+	localStats.reached[int(BankScanStage::Signature)] = localStats.positions;
+
+	std::vector<FoundBank> banks;
+	for (uint32_t const candidate : candidates)
+	{
+		BankScanStage const failedAt = validateMusicBank(rom, candidate);
+
+		// the candidate passed the signature check to get here, and every stage before the one it failed at
+		for (int stage = int(BankScanStage::SongOffsets); stage <= int(failedAt); ++stage)
+		{
+			localStats.reached[stage]++;
+		}
+
+		if (failedAt == BankScanStage::Accepted)
+		{
+			FoundBank bank;
+			bank.address = candidate;
+			memcpy(&bank.header, rom.data+candidate, sizeof(bank.header));
+			banks.push_back(bank);
+		}
+	}
+
+	if (stats)
+		stats->merge(localStats);
+
+	return banks;
+}
+
+std::vector<FoundBank> scanForMusicBanksParallel(ByteView rom, int threadCount, BankScanStats* stats)
+{
+	// small chunks balance the load better, but each one has some fixed overhead
+	size_t const kMinChunkSize = 256*1024;
+	size_t const kChunksPerThread = 4;
+
+	size_t chunkCount = std::max<size_t>(1, rom.size / kMinChunkSize);
+	chunkCount = std::min<size_t>(chunkCount, std::max(threadCount, 1) * kChunksPerThread);
+	if (threadCount <= 1 || chunkCount <= 1)
+		return scanForMusicBanks(rom, 0, rom.size, stats);
+
+	// chunk boundaries stay 4-aligned, so every candidate header lies in exactly one chunk.
+	// validation may still read past the end of its chunk, which is fine since every thread sees the whole rom.
+	size_t const chunkSize = ((rom.size / chunkCount) + 3) & ~size_t(3);
+
+	std::vector<std::vector<FoundBank>> chunkBanks(chunkCount);
+	std::vector<BankScanStats> chunkStats(chunkCount);
+
+	parallelFor(chunkCount, threadCount, [&](size_t chunkIndex) {
+		size_t const begin = chunkIndex*chunkSize;
+		size_t const end = (chunkIndex+1 == chunkCount) ? rom.size : std::min(rom.size, begin+chunkSize);
+		chunkBanks[chunkIndex] = scanForMusicBanks(rom, begin, end, &chunkStats[chunkIndex]);
+	});
+
+	std::vector<FoundBank> banks;
+	for (size_t chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+	{
+		banks.insert(banks.end(), chunkBanks[chunkIndex].begin(), chunkBanks[chunkIndex].end());
+		if (stats)
+			stats->merge(chunkStats[chunkIndex]);
+	}
+	return banks;
+}
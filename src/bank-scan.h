@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "common-gba.h"
+#include "mapped-file.h"
+
+// the checks a potential music bank goes through, in order
+enum class BankScanStage {
+	Signature,   // id 0x0121 with non-zero instrument and song counts
+	SongOffsets, // song offset table fits in the rom
+	Instruments, // instrument headers fit in the rom and have sane envelopes
+	Overlap,     // instruments don't run into the first song
+	SongOrder,   // song offsets are sorted
+	Songs,       // song headers and pattern orders are sane
+	Accepted,
+};
+int const kBankScanStageCount = int(BankScanStage::Accepted)+1;
+
+char const* bankScanStageName(BankScanStage stage);
+
+
+struct BankScanStats {
+	uint64_t positions = 0; // 4-aligned addresses considered
+	uint64_t reached[kBankScanStageCount] = {}; // how many candidates made it to each stage
+
+	void merge(BankScanStats const& other);
+};
+
+
+struct FoundBank {
+	uint32_t address;
+	gba_musicbank_header_t header;
+};
+
+
+// collects every 4-aligned address in [begin,end) holding a plausible bank header.
+// this is the cheap streaming pass; candidates still need validating.
+void findBankCandidates(ByteView rom, size_t begin, size_t end, std::vector<uint32_t>& candidates);
+
+// runs the full set of checks on a candidate, returning the stage it failed at (or Accepted).
+// reads may go anywhere in the rom, regardless of which range the candidate was found in.
+BankScanStage validateMusicBank(ByteView rom, uint32_t baseAddr);
+
+// finds and validates every music bank whose header lies in [begin,end)
+std::vector<FoundBank> scanForMusicBanks(ByteView rom, size_t begin, size_t end, BankScanStats* stats = nullptr);
+
+// as above, but splits the rom into address ranges that are scanned and validated on up to threadCount threads.
+// results are merged back into address order.
+std::vector<FoundBank> scanForMusicBanksParallel(ByteView rom, int threadCount, BankScanStats* stats = nullptr);
@@ -0,0 +1,249 @@
+#include <algorithm>
+#include <cstring>
+#include "common-gba.h"
+#include "misc.h"
+#include "trace.h"
+
+// snapshot layout, all little-endian. every offset is from the start of the file, and every section is 8-aligned.
+//
+//	snapshot_header_t
+//	snapshot_instrument_t[instrumentCount]
+//	snapshot_song_t[songCount]
+//	for each song:    the pattern order, then snapshot_pattern_t[patternCount]
+//	for each pattern: rowCount*channelCount SharedCells, row-major, exactly as SharedPattern stores them
+//	for each sample:  the signed 8-bit PCM
+namespace
+{
+	char const kSnapshotMagic[8] = { 'E', 'S', 'G', 'B', 'A', 'S', 'N', 'P' };
+
+	// bump this whenever the layout changes; older snapshots are then rejected rather than misread
+	uint32_t const kSnapshotVersion = 1;
+
+	uint32_t const kSnapshotTruncated = 0x1;
+
+	struct snapshot_header_t {
+		char magic[8];
+		uint32_t version;
+		uint32_t flags;
+		uint32_t bankAddress;
+		char fourcc[4];
+		uint32_t instrumentCount;
+		uint32_t songCount;
+		uint64_t referencedRowCount;
+		uint64_t uniqueRowCount;
+	};
+	static_assert(sizeof(snapshot_header_t) == 48);
+
+	struct snapshot_instrument_t {
+		gba_instrument_header_t header;
+		uint32_t padding;
+		uint64_t sampleOffset;
+		uint64_t sampleLength; // may be shorter than header.sampleLength, if the sample ran off the end of the rom
+	};
+	static_assert(sizeof(snapshot_instrument_t) == 144);
+
+	struct snapshot_song_t {
+		gba_song_header_t header;
+		uint16_t padding;
+		uint32_t patternOrderLength;
+		uint8_t usedInstruments[32]; // bit N of byte N/8
+		uint64_t patternOrderOffset;
+		uint64_t patternTableOffset;
+	};
+	static_assert(sizeof(snapshot_song_t) == 64);
+
+	struct snapshot_pattern_t {
+		uint32_t rowCount;
+		uint32_t channelCount;
+		uint64_t cellsOffset;
+	};
+	static_assert(sizeof(snapshot_pattern_t) == 16);
+
+	size_t alignUp(size_t value)
+	{
+		return (value+7) & ~size_t(7);
+	}
+
+	// appends a blob to the end of the snapshot, returning where it went. a null blob just reserves the space.
+	size_t append(std::vector<uint8_t>& bytes, void const* data, size_t size)
+	{
+		size_t const offset = alignUp(bytes.size());
+		bytes.resize(offset+size);
+		if (data && size > 0)
+			memcpy(bytes.data()+offset, data, size);
+		return offset;
+	}
+
+	template<typename T> void patch(std::vector<uint8_t>& bytes, size_t offset, T const& value)
+	{
+		memcpy(bytes.data()+offset, &value, sizeof(T));
+	}
+}
+
+bool GBAMusicBank::saveSnapshot(FILE* fh, std::string const& fourcc)
+{
+	TRACE_SCOPE("save snapshot");
+
+	for (size_t songIndex = 0; songIndex < this->songCount(); ++songIndex)
+	{
+		this->song(songIndex);
+	}
+
+	std::vector<uint8_t> bytes;
+
+	snapshot_header_t header = {};
+	memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+	header.version = kSnapshotVersion;
+	header.flags = this->truncated ? kSnapshotTruncated : 0;
+	header.bankAddress = uint32_t(this->baseAddr);
+	memcpy(header.fourcc, fourcc.data(), std::min<size_t>(fourcc.size(), sizeof(header.fourcc)));
+	header.instrumentCount = uint32_t(this->instruments.size());
+	header.songCount = uint32_t(this->songs.size());
+	header.referencedRowCount = this->referencedRowCount;
+	header.uniqueRowCount = this->uniqueRowCount;
+	append(bytes, &header, sizeof(header));
+
+	// the tables go first, and get filled in as the things they point at are appended
+	size_t const instrumentTable = append(bytes, nullptr, sizeof(snapshot_instrument_t)*this->instruments.size());
+	size_t const songTable = append(bytes, nullptr, sizeof(snapshot_song_t)*this->songs.size());
+
+	for (size_t songIndex = 0; songIndex < this->songs.size(); ++songIndex)
+	{
+		GBASong const& song = *this->songs[songIndex];
+
+		snapshot_song_t entry = {};
+		entry.header = song.header;
+		entry.patternOrderLength = uint32_t(song.patternOrder.size());
+		for (int instIndex = 0; instIndex < 256; ++instIndex)
+		{
+			if (song.usedInstruments[instIndex])
+				entry.usedInstruments[instIndex/8] |= uint8_t(1 << (instIndex%8));
+		}
+		entry.patternOrderOffset = append(bytes, song.patternOrder.data(), song.patternOrder.size());
+		entry.patternTableOffset = append(bytes, nullptr, sizeof(snapshot_pattern_t)*song.patterns.size());
+
+		for (size_t patternIndex = 0; patternIndex < song.patterns.size(); ++patternIndex)
+		{
+			SharedPattern const& pattern = song.patterns[patternIndex];
+
+			snapshot_pattern_t patternEntry = {};
+			patternEntry.rowCount = uint32_t(pattern.rowCount());
+			patternEntry.channelCount = uint32_t(pattern.channelCount());
+			patternEntry.cellsOffset = append(bytes, pattern.cells().data(), pattern.cells().size()*sizeof(SharedCell));
+			patch(bytes, entry.patternTableOffset + patternIndex*sizeof(snapshot_pattern_t), patternEntry);
+		}
+
+		patch(bytes, songTable + songIndex*sizeof(snapshot_song_t), entry);
+	}
+
+	for (size_t instIndex = 0; instIndex < this->instruments.size(); ++instIndex)
+	{
+		GBAInstrument const& instrument = this->instruments[instIndex];
+
+		snapshot_instrument_t entry = {};
+		entry.header = instrument.header;
+		entry.sampleLength = instrument.sample.size();
+		entry.sampleOffset = append(bytes, instrument.sample.data(), instrument.sample.size());
+		patch(bytes, instrumentTable + instIndex*sizeof(snapshot_instrument_t), entry);
+	}
+
+	size_t const written = fwrite(bytes.data(), 1, bytes.size(), fh);
+	countAdd(Counter::BytesWritten, written);
+	return written == bytes.size();
+}
+
+std::optional<GBAMusicBank> GBAMusicBank::loadSnapshot(ByteView snapshot, std::string* fourcc)
+{
+	TRACE_SCOPE("load snapshot");
+
+	ByteReader reader(snapshot);
+
+	snapshot_header_t const header = reader.read<snapshot_header_t>();
+	if (reader.overrun || memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 || header.version != kSnapshotVersion)
+		return std::nullopt;
+
+	// a real bank's header only has a byte for each of these
+	if (header.instrumentCount > 0xff || header.songCount > 0xff)
+		return std::nullopt;
+
+	GBAMusicBank bank;
+	bank.baseAddr = header.bankAddress;
+	bank.truncated = (header.flags & kSnapshotTruncated) != 0;
+	bank.referencedRowCount = header.referencedRowCount;
+	bank.uniqueRowCount = header.uniqueRowCount;
+	*fourcc = std::string(header.fourcc, strnlen(header.fourcc, sizeof(header.fourcc)));
+
+	reader.align(8);
+	std::vector<snapshot_instrument_t> const instrumentTable = reader.readArray<snapshot_instrument_t>(header.instrumentCount);
+	reader.align(8);
+	std::vector<snapshot_song_t> const songTable = reader.readArray<snapshot_song_t>(header.songCount);
+	if (reader.overrun)
+		return std::nullopt;
+
+	bank.instruments.resize(instrumentTable.size());
+	for (size_t instIndex = 0; instIndex < instrumentTable.size(); ++instIndex)
+	{
+		snapshot_instrument_t const& entry = instrumentTable[instIndex];
+		GBAInstrument& instrument = bank.instruments[instIndex];
+		instrument.header = entry.header;
+
+		if (!snapshot.contains(entry.sampleOffset, entry.sampleLength))
+			return std::nullopt;
+		instrument.sample = Span<int8_t const>(reinterpret_cast<int8_t const*>(snapshot.data+entry.sampleOffset), entry.sampleLength);
+	}
+
+	countAdd(Counter::BytesTouched, reader.pos);
+	countAdd(Counter::DiscontiguousReads, 1);
+
+	bank.songs.resize(songTable.size());
+	for (size_t songIndex = 0; songIndex < songTable.size(); ++songIndex)
+	{
+		snapshot_song_t const& entry = songTable[songIndex];
+		GBASong& song = bank.songs[songIndex].emplace();
+		song.header = entry.header;
+		for (int instIndex = 0; instIndex < 256; ++instIndex)
+		{
+			song.usedInstruments[instIndex] = (entry.usedInstruments[instIndex/8] >> (instIndex%8)) & 1;
+		}
+
+		if (entry.patternOrderLength != entry.header.songLength)
+			return std::nullopt;
+		reader.seek(entry.patternOrderOffset);
+		song.patternOrder = reader.readArray<uint8_t>(entry.patternOrderLength);
+
+		reader.seek(entry.patternTableOffset);
+		std::vector<snapshot_pattern_t> const patternTable = reader.readArray<snapshot_pattern_t>(entry.header.patternCount);
+		if (reader.overrun)
+			return std::nullopt;
+
+		// the xm writer trusts these, so anything a real bank couldn't have produced is rejected here
+		if (song.header.channelCount == 0)
+			return std::nullopt;
+		for (uint8_t patternIndex : song.patternOrder)
+		{
+			if (patternIndex >= patternTable.size())
+				return std::nullopt;
+		}
+		countAdd(Counter::BytesTouched, song.patternOrder.size() + patternTable.size()*sizeof(snapshot_pattern_t));
+		countAdd(Counter::DiscontiguousReads, 2);
+
+		song.patterns.resize(patternTable.size());
+		for (size_t patternIndex = 0; patternIndex < patternTable.size(); ++patternIndex)
+		{
+			snapshot_pattern_t const& patternEntry = patternTable[patternIndex];
+			if (patternEntry.channelCount != song.header.channelCount || patternEntry.rowCount > 0xffff)
+				return std::nullopt;
+			size_t const cellCount = size_t(patternEntry.rowCount)*patternEntry.channelCount;
+			if (!snapshot.contains(patternEntry.cellsOffset, cellCount*sizeof(SharedCell)))
+				return std::nullopt;
+
+			SharedPattern& pattern = song.patterns[patternIndex];
+			pattern.resize(patternEntry.rowCount, patternEntry.channelCount);
+			memcpy(pattern.cells().data(), snapshot.data+patternEntry.cellsOffset, cellCount*sizeof(SharedCell));
+			countAdd(Counter::BytesTouched, cellCount*sizeof(SharedCell));
+			countAdd(Counter::CellsMaterialized, cellCount);
+		}
+	}
+
+	return bank;
+}
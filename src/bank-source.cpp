@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <fmt/core.h>
+#include "bank-source.h"
+#include "convert.h"
+#include "misc.h"
+
+OpenedBank openBankFromRom(char const* romPath, char const* bankAddressStr)
+{
+	OpenedBank opened;
+	opened.path = romPath;
+
+	opened.file = std::make_unique<MappedFile>(romPath);
+	if (!opened.file->isOpen())
+	{
+		fmt::print(stderr, "Failed to open {} for reading\n", romPath);
+		exit(1);
+	}
+
+	int64_t bankAddress = 0;
+	if (!tryParseNumber(bankAddressStr, &bankAddress))
+	{
+		fmt::print(stderr, "Failed to parse '{}' as a number\n", bankAddressStr);
+		exit(1);
+	}
+	// in case the user used an 08xxxxxx address, mask off the top bits
+	bankAddress &= 0x00ffffff;
+
+	// the bank reads its row data in one forward sweep, so the kernel's default readahead suits it
+	opened.bank.emplace(opened.file->view(), bankAddress);
+	opened.fourcc = cartFourcc(opened.file->view());
+	return opened;
+}
+
+OpenedBank openBankFromSnapshot(char const* snapshotPath)
+{
+	OpenedBank opened;
+	opened.path = snapshotPath;
+
+	opened.file = std::make_unique<MappedFile>(snapshotPath);
+	if (!opened.file->isOpen())
+	{
+		fmt::print(stderr, "Failed to open {} for reading\n", snapshotPath);
+		exit(1);
+	}
+
+	opened.bank = GBAMusicBank::loadSnapshot(opened.file->view(), &opened.fourcc);
+	if (!opened.bank)
+	{
+		fmt::print(stderr, "{} isn't a snapshot this version can read\n", snapshotPath);
+		exit(1);
+	}
+	return opened;
+}
+
+void saveBankSnapshot(OpenedBank& opened, char const* snapshotPath)
+{
+	FILE* fh = fopen(snapshotPath, "wb");
+	if (!fh)
+	{
+		fmt::print(stderr, "Failed to open {} for writing\n", snapshotPath);
+		exit(1);
+	}
+	bool const saved = opened.bank->saveSnapshot(fh, opened.fourcc);
+	if (fclose(fh) != 0 || !saved)
+	{
+		fmt::print(stderr, "Failed to write a snapshot to {}\n", snapshotPath);
+		exit(1);
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include "common-gba.h"
+#include "mapped-file.h"
+
+// the bank a tool works on, opened either from a rom or from a snapshot saved earlier
+struct OpenedBank {
+	std::unique_ptr<MappedFile> file; // the rom or snapshot, which the bank points into
+	std::optional<GBAMusicBank> bank;
+	std::string fourcc;
+	std::string path;
+};
+
+// these print a message and exit on failure, as the tools would
+OpenedBank openBankFromRom(char const* romPath, char const* bankAddressStr);
+OpenedBank openBankFromSnapshot(char const* snapshotPath);
+void saveBankSnapshot(OpenedBank& opened, char const* snapshotPath);
@@ -0,0 +1,156 @@
+#include <cstring>
+#include <string_view>
+#include <unordered_set>
+#include "common-gba.h"
+#include "misc.h"
+#include "row-decode.h"
+#include "trace.h"
+
+// writes the layout the readme describes: the header, song offsets and instruments,
+// then every distinct row once, then the songs with their pattern tables pointing into those rows.
+namespace
+{
+	template<typename T> void append(std::vector<uint8_t>& bytes, T const& value)
+	{
+		uint8_t const* ptr = reinterpret_cast<uint8_t const*>(&value);
+		bytes.insert(bytes.end(), ptr, ptr+sizeof(T));
+	}
+
+	void align(std::vector<uint8_t>& bytes)
+	{
+		bytes.resize((bytes.size()+3) & ~size_t(3));
+	}
+
+	// a packed row already written out, identified by where it is so that the set doesn't keep copies of every row
+	struct PackedRow {
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	struct PackedRowSet {
+		std::vector<uint8_t> const& bytes;
+
+		std::string_view view(PackedRow row) const
+		{
+			return std::string_view(reinterpret_cast<char const*>(this->bytes.data()+row.offset), row.size);
+		}
+		size_t operator()(PackedRow row) const
+		{
+			return std::hash<std::string_view>()(this->view(row));
+		}
+		bool operator()(PackedRow a, PackedRow b) const
+		{
+			return this->view(a) == this->view(b);
+		}
+	};
+
+	bool isEmptyRow(Span<SharedCell const> row)
+	{
+		for (SharedCell const& cell : row)
+		{
+			if (cell.note || cell.inst || cell.vol || cell.effect || cell.param)
+				return false;
+		}
+		return true;
+	}
+}
+
+std::vector<uint8_t> GBAMusicBank::serialize()
+{
+	TRACE_SCOPE("serialize bank");
+
+	for (size_t songIndex = 0; songIndex < this->songCount(); ++songIndex)
+	{
+		this->song(songIndex);
+	}
+
+	std::vector<uint8_t> bytes;
+
+	gba_musicbank_header_t header = {};
+	header.version = 0x0121;
+	header.instrumentCount = uint8_t(this->instruments.size());
+	header.songCount = uint8_t(this->songs.size());
+	append(bytes, header);
+
+	size_t const songOffsetTable = bytes.size();
+	bytes.resize(bytes.size() + this->songs.size()*sizeof(uint32_t));
+
+	for (GBAInstrument const& instrument : this->instruments)
+	{
+		// a sample that ran off the end of the rom is written as however much of it there was
+		gba_instrument_header_t instHeader = instrument.header;
+		instHeader.sampleLength = uint32_t(instrument.sample.size());
+		append(bytes, instHeader);
+		bytes.insert(bytes.end(), reinterpret_cast<uint8_t const*>(instrument.sample.data()), reinterpret_cast<uint8_t const*>(instrument.sample.data())+instrument.sample.size());
+		align(bytes);
+	}
+
+	// every row reference, in song and pattern order. each row is packed onto the end of the bank,
+	// and taken back off again if an identical one is already there. a row's packed bytes alone decide
+	// how it decodes, whatever the song's channel count, since the padding bits are always clear.
+	std::vector<std::vector<uint32_t>> rowOffsets;
+	PackedRowSet const rowSet{ bytes };
+	std::unordered_set<PackedRow, PackedRowSet, PackedRowSet> packedRows(0, rowSet, rowSet);
+	for (std::optional<GBASong> const& song : this->songs)
+	{
+		for (SharedPattern const& pattern : song->patterns)
+		{
+			std::vector<uint32_t>& offsets = rowOffsets.emplace_back(pattern.rowCount(), 0);
+			for (size_t rowIndex = 0; rowIndex < pattern.rowCount(); ++rowIndex)
+			{
+				Span<SharedCell const> const row = pattern.row(rowIndex);
+				if (isEmptyRow(row))
+					continue;
+
+				size_t const rowOffset = bytes.size();
+				bytes.resize(rowOffset + packedRowCapacity(int(pattern.channelCount())));
+				size_t const packedSize = encodeRow(row.data(), int(pattern.channelCount()), bytes.data()+rowOffset);
+				bytes.resize(rowOffset + packedSize);
+
+				auto const inserted = packedRows.insert({ uint32_t(rowOffset), uint32_t(packedSize) });
+				if (!inserted.second)
+					bytes.resize(rowOffset);
+				offsets[rowIndex] = inserted.first->offset;
+			}
+		}
+	}
+	align(bytes);
+
+	size_t patternIndexInBank = 0;
+	for (size_t songIndex = 0; songIndex < this->songs.size(); ++songIndex)
+	{
+		GBASong const& song = *this->songs[songIndex];
+
+		uint32_t const songOffset = uint32_t(bytes.size());
+		memcpy(bytes.data() + songOffsetTable + songIndex*sizeof(uint32_t), &songOffset, sizeof(songOffset));
+
+		gba_song_header_t songHeader = song.header;
+		songHeader.songLength = uint8_t(song.patternOrder.size());
+		songHeader.patternCount = uint8_t(song.patterns.size());
+		append(bytes, songHeader);
+		align(bytes);
+
+		bytes.insert(bytes.end(), song.patternOrder.begin(), song.patternOrder.end());
+		align(bytes);
+
+		for (SharedPattern const& pattern : song.patterns)
+		{
+			append(bytes, uint16_t(pattern.rowCount()));
+			align(bytes);
+			for (uint32_t offset : rowOffsets[patternIndexInBank++])
+			{
+				append(bytes, offset);
+			}
+		}
+	}
+
+	return bytes;
+}
+
+bool GBAMusicBank::save(FILE* fh)
+{
+	std::vector<uint8_t> const bytes = this->serialize();
+	size_t const written = fwrite(bytes.data(), 1, bytes.size(), fh);
+	countAdd(Counter::BytesWritten, written);
+	return written == bytes.size();
+}
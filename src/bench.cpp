@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <fmt/core.h>
+#include "bank-scan.h"
+#include "common.h"
+#include "common-gba.h"
+#include "convert.h"
+#include "delta.h"
+#include "misc.h"
+#include "row-decode.h"
+
+struct PackedRows {
+	int channelCount;
+	std::vector<uint8_t> bytes;
+	std::vector<size_t> offsets;
+};
+
+PackedRows generateRows(int channelCount, size_t rowCount, double density, std::mt19937& rng)
+{
+	PackedRows rows;
+	rows.channelCount = channelCount;
+
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	std::uniform_int_distribution<int> byteValue(1, 255);
+
+	size_t const bitmaskLength = ((channelCount*5)+7)/8;
+	for (size_t rowIndex = 0; rowIndex < rowCount; ++rowIndex)
+	{
+		rows.offsets.push_back(rows.bytes.size());
+
+		std::vector<uint8_t> bitmask(bitmaskLength, 0);
+		std::vector<uint8_t> data;
+		for (int bit = 0; bit < channelCount*5; ++bit)
+		{
+			if (chance(rng) < density)
+			{
+				bitmask[bit/8] |= (0x80>>(bit%8));
+				data.push_back(byteValue(rng));
+			}
+		}
+		rows.bytes.insert(rows.bytes.end(), bitmask.begin(), bitmask.end());
+		rows.bytes.insert(rows.bytes.end(), data.begin(), data.end());
+	}
+	return rows;
+}
+
+// decodes every row, returning the time taken in seconds
+double timeDecoder(RowDecoder decoder, PackedRows const& rows, int iterations, std::vector<SharedCell>& cells)
+{
+	cells.assign(rows.offsets.size() * rows.channelCount, SharedCell());
+
+	auto const start = std::chrono::steady_clock::now();
+	for (int iteration = 0; iteration < iterations; ++iteration)
+	{
+		for (size_t rowIndex = 0; rowIndex < rows.offsets.size(); ++rowIndex)
+		{
+			size_t const offset = rows.offsets[rowIndex];
+			decoder(rows.bytes.data()+offset, rows.bytes.size()-offset, rows.channelCount, cells.data() + rowIndex*rows.channelCount);
+		}
+	}
+	auto const end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end-start).count();
+}
+
+bool cellsMatch(std::vector<SharedCell> const& a, std::vector<SharedCell> const& b)
+{
+	return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()*sizeof(SharedCell)) == 0;
+}
+
+void benchRowDecode()
+{
+	struct Candidate {
+		char const* name;
+		RowDecoder decoder;
+		bool supported;
+	};
+	Candidate const candidates[] = {
+		{ "reference", decodeRowReference, true },
+		{ "lut",       decodeRowLUT,       true },
+		{ "bmi2",      decodeRowBMI2,      cpuSupportsBMI2() },
+	};
+
+	size_t const kRowCount = 100000;
+	int const kIterations = 20;
+
+	std::mt19937 rng(1234);
+
+	fmt::print("row decode ({} rows x {} iterations)\n", kRowCount, kIterations);
+	for (int channelCount : { 4, 6, 8, 12, 32 })
+	{
+		for (double density : { 0.1, 0.4 })
+		{
+			PackedRows const rows = generateRows(channelCount, kRowCount, density, rng);
+
+			std::vector<SharedCell> expected;
+			double const referenceTime = timeDecoder(decodeRowReference, rows, kIterations, expected);
+
+			for (Candidate const& candidate : candidates)
+			{
+				if (!candidate.supported)
+				{
+					fmt::print("\t{:2} channels, {:.0f}% full, {:<10} unsupported on this cpu\n", channelCount, density*100, candidate.name);
+					continue;
+				}
+
+				std::vector<SharedCell> cells;
+				double const time = timeDecoder(candidate.decoder, rows, kIterations, cells);
+				double const rowsPerSecond = (kRowCount*kIterations) / time;
+
+				fmt::print("\t{:2} channels, {:.0f}% full, {:<10} {:8.2f} Mrows/s  {:5.2f}x{}\n",
+					channelCount,
+					density*100,
+					candidate.name,
+					rowsPerSecond / 1e6,
+					referenceTime / time,
+					cellsMatch(cells, expected) ? "" : "  MISMATCH");
+			}
+		}
+	}
+}
+
+void benchDelta()
+{
+	size_t const kSampleLength = 16*1024*1024;
+	int const kIterations = 10;
+
+	std::mt19937 rng(5678);
+	std::vector<int8_t> pcm(kSampleLength);
+	for (int8_t& value : pcm)
+		value = int8_t(rng());
+
+	std::vector<int8_t> encoded(kSampleLength);
+	std::vector<int8_t> decoded(kSampleLength);
+
+	struct Candidate {
+		char const* name;
+		void (*function)(int8_t const*, int8_t*, size_t);
+		bool isEncode;
+	};
+	Candidate const candidates[] = {
+		{ "encode (scalar)", deltaEncodeScalar, true },
+		{ "encode",          deltaEncode,       true },
+		{ "decode (scalar)", deltaDecodeScalar, false },
+		{ "decode",          deltaDecode,       false },
+	};
+
+	fmt::print("delta coding ({} MB x {} iterations)\n", kSampleLength/(1024*1024), kIterations);
+	for (Candidate const& candidate : candidates)
+	{
+		int8_t const* src = candidate.isEncode ? pcm.data() : encoded.data();
+		int8_t* dst = candidate.isEncode ? encoded.data() : decoded.data();
+
+		auto const start = std::chrono::steady_clock::now();
+		for (int iteration = 0; iteration < kIterations; ++iteration)
+		{
+			candidate.function(src, dst, kSampleLength);
+		}
+		auto const end = std::chrono::steady_clock::now();
+		double const time = std::chrono::duration<double>(end-start).count();
+
+		bool const valid = candidate.isEncode || (decoded == pcm);
+		fmt::print("\t{:<16} {:8.1f} MB/s{}\n",
+			candidate.name,
+			(double(kSampleLength)*kIterations / (1024*1024)) / time,
+			valid ? "" : "  MISMATCH");
+	}
+}
+
+struct SyntheticBankOptions {
+	int songCount = 8;
+	int patternsPerSong = 32;
+	int rowsPerPattern = 64;
+	int channelCount = 8;
+	int instrumentCount = 16;
+	uint32_t sampleLength = 16*1024;
+	double emptyRowChance = 0.25;
+	double uniqueRowFraction = 0.25; // of all the non-empty row references, how many distinct rows there are
+	size_t romSize = 16*1024*1024;
+	int iterations = 5;
+};
+
+struct SyntheticRom {
+	std::vector<uint8_t> bytes;
+	size_t bankAddress = 0;
+	size_t bankSize = 0;
+};
+
+void appendBytes(std::vector<uint8_t>& bytes, void const* data, size_t size)
+{
+	uint8_t const* ptr = static_cast<uint8_t const*>(data);
+	bytes.insert(bytes.end(), ptr, ptr+size);
+}
+
+void alignBytes(std::vector<uint8_t>& bytes)
+{
+	bytes.resize((bytes.size()+3) & ~size_t(3));
+}
+
+// a bank laid out as the readme describes it: header, song offsets, instruments, a shared pool of row data, then the songs
+std::vector<uint8_t> generateBank(SyntheticBankOptions const& options, std::mt19937& rng)
+{
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	std::uniform_int_distribution<int> note(1, 96);
+	std::uniform_int_distribution<int> inst(1, options.instrumentCount);
+	std::uniform_int_distribution<int> byteValue(0, 255);
+
+	std::vector<uint8_t> bank;
+
+	gba_musicbank_header_t header = {};
+	header.version = 0x0121;
+	header.instrumentCount = uint8_t(options.instrumentCount);
+	header.songCount = uint8_t(options.songCount);
+	appendBytes(bank, &header, sizeof(header));
+
+	size_t const songOffsetTable = bank.size();
+	bank.resize(bank.size() + options.songCount*sizeof(uint32_t));
+
+	for (int instIndex = 0; instIndex < options.instrumentCount; ++instIndex)
+	{
+		gba_instrument_header_t instHeader = {};
+		instHeader.sampleLength = options.sampleLength;
+		instHeader.sampleLoopLength = options.sampleLength/2;
+		instHeader.sampleLoopStart = options.sampleLength/2;
+		instHeader.sampleVolume = 64;
+		instHeader.samplePanning = 128;
+		instHeader.volumeEnvelope.maybeSustainPoint = 0xff;
+		instHeader.volumeEnvelope.maybeLoopStartPoint = 0xff;
+		instHeader.volumeEnvelope.maybeLoopEndPoint = 0xff;
+		instHeader.panningEnvelope = instHeader.volumeEnvelope;
+		appendBytes(bank, &instHeader, sizeof(instHeader));
+
+		for (uint32_t i = 0; i < options.sampleLength; ++i)
+			bank.push_back(uint8_t(byteValue(rng)));
+		alignBytes(bank);
+	}
+
+	// the pool every pattern draws its rows from, so rows get reused the way they do in real banks
+	size_t const referenceCount = size_t(options.songCount)*options.patternsPerSong*options.rowsPerPattern;
+	size_t const poolSize = std::max<size_t>(1, size_t(referenceCount*(1.0-options.emptyRowChance)*options.uniqueRowFraction));
+	std::vector<uint32_t> rowOffsets;
+	for (size_t rowIndex = 0; rowIndex < poolSize; ++rowIndex)
+	{
+		rowOffsets.push_back(uint32_t(bank.size()));
+
+		std::vector<SharedCell> cells(options.channelCount);
+		for (SharedCell& cell : cells)
+		{
+			if (chance(rng) < 0.5)
+			{
+				cell.note = uint8_t(note(rng));
+				cell.inst = uint8_t(inst(rng));
+			}
+			if (chance(rng) < 0.2)
+				cell.vol = uint8_t(0x10 + byteValue(rng)%0x40);
+			if (chance(rng) < 0.2)
+			{
+				cell.effect = uint8_t(byteValue(rng)%16);
+				cell.param = uint8_t(byteValue(rng));
+			}
+		}
+
+		std::vector<uint8_t> bitmask((options.channelCount*5+7)/8, 0);
+		std::vector<uint8_t> data;
+		uint8_t const* fields = reinterpret_cast<uint8_t const*>(cells.data());
+		for (int bit = 0; bit < options.channelCount*5; ++bit)
+		{
+			if (fields[bit])
+			{
+				bitmask[bit/8] |= (0x80>>(bit%8));
+				data.push_back(fields[bit]);
+			}
+		}
+		appendBytes(bank, bitmask.data(), bitmask.size());
+		appendBytes(bank, data.data(), data.size());
+	}
+	alignBytes(bank);
+
+	std::uniform_int_distribution<size_t> poolIndex(0, poolSize-1);
+	for (int songIndex = 0; songIndex < options.songCount; ++songIndex)
+	{
+		uint32_t const songOffset = uint32_t(bank.size());
+		memcpy(bank.data() + songOffsetTable + songIndex*sizeof(uint32_t), &songOffset, sizeof(songOffset));
+
+		gba_song_header_t songHeader = {};
+		songHeader.channelCount = uint8_t(options.channelCount);
+		songHeader.songLength = uint8_t(options.patternsPerSong);
+		songHeader.patternCount = uint8_t(options.patternsPerSong);
+		songHeader.tickrate = 6;
+		songHeader.tempo = 125;
+		appendBytes(bank, &songHeader, sizeof(songHeader));
+		alignBytes(bank);
+
+		for (int orderIndex = 0; orderIndex < options.patternsPerSong; ++orderIndex)
+			bank.push_back(uint8_t(orderIndex));
+		alignBytes(bank);
+
+		for (int patternIndex = 0; patternIndex < options.patternsPerSong; ++patternIndex)
+		{
+			uint16_t const rowCount = uint16_t(options.rowsPerPattern);
+			appendBytes(bank, &rowCount, sizeof(rowCount));
+			alignBytes(bank);
+
+			for (int rowIndex = 0; rowIndex < options.rowsPerPattern; ++rowIndex)
+			{
+				uint32_t const offset = (chance(rng) < options.emptyRowChance) ? 0 : rowOffsets[poolIndex(rng)];
+				appendBytes(bank, &offset, sizeof(offset));
+			}
+		}
+	}
+
+	return bank;
+}
+
+// random filler with the bank somewhere in the middle, much as a real rom would have code and graphics around it
+SyntheticRom generateRom(SyntheticBankOptions const& options, std::mt19937& rng)
+{
+	std::vector<uint8_t> const bank = generateBank(options, rng);
+
+	SyntheticRom rom;
+	rom.bytes.resize(std::max(options.romSize, bank.size()+0x200));
+	for (uint8_t& byte : rom.bytes)
+		byte = uint8_t(rng());
+
+	memcpy(rom.bytes.data()+0xAC, "BNCH", 4);
+	rom.bankAddress = ((rom.bytes.size()-bank.size())/2) & ~size_t(3);
+	rom.bankSize = bank.size();
+	memcpy(rom.bytes.data()+rom.bankAddress, bank.data(), bank.size());
+	return rom;
+}
+
+template<typename Fn>
+double timeIterations(int iterations, Fn&& fn)
+{
+	auto const start = std::chrono::steady_clock::now();
+	for (int iteration = 0; iteration < iterations; ++iteration)
+		fn();
+	auto const end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end-start).count();
+}
+
+void benchPipeline(SyntheticBankOptions const& options)
+{
+	std::mt19937 rng(4321);
+	SyntheticRom const rom = generateRom(options, rng);
+	ByteView const romView(rom.bytes.data(), rom.bytes.size());
+	int const iterations = options.iterations;
+
+	size_t const rowCount = size_t(options.songCount)*options.patternsPerSong*options.rowsPerPattern;
+
+	fmt::print("pipeline ({} songs x {} patterns x {} rows, {} channels, {} x {} byte samples; {:.1f} MB bank in a {:.1f} MB rom; {} iterations)\n",
+		options.songCount, options.patternsPerSong, options.rowsPerPattern, options.channelCount,
+		options.instrumentCount, options.sampleLength,
+		rom.bankSize / (1024.0*1024.0), rom.bytes.size() / (1024.0*1024.0),
+		iterations);
+
+	std::vector<FoundBank> found;
+	double const scanTime = timeIterations(iterations, [&]() {
+		found = scanForMusicBanks(romView, 0, romView.size);
+	});
+	bool const foundBank = std::any_of(found.begin(), found.end(), [&](FoundBank const& bank) { return bank.address == rom.bankAddress; });
+	fmt::print("\t{:<10} {:8.1f} MB/s{}\n", "scan",
+		(double(rom.bytes.size())*iterations / (1024*1024)) / scanTime,
+		foundBank ? "" : "  BANK NOT FOUND");
+
+	// parsing includes decoding every song, since that's where nearly all of the work is
+	double const parseTime = timeIterations(iterations, [&]() {
+		GBAMusicBank bank(romView, rom.bankAddress);
+		for (size_t songIndex = 0; songIndex < bank.songCount(); ++songIndex)
+			bank.song(songIndex);
+	});
+	fmt::print("\t{:<10} {:8.1f} MB/s  {:8.2f} Mrows/s\n", "parse",
+		(double(rom.bankSize)*iterations / (1024*1024)) / parseTime,
+		(double(rowCount)*iterations / 1e6) / parseTime);
+
+	GBAMusicBank bank(romView, rom.bankAddress);
+	for (size_t songIndex = 0; songIndex < bank.songCount(); ++songIndex)
+		bank.song(songIndex);
+
+	std::vector<XMFile> modules(bank.songCount());
+	double const convertTime = timeIterations(iterations, [&]() {
+		for (size_t songIndex = 0; songIndex < bank.songCount(); ++songIndex)
+			modules[songIndex] = convertSong(bank, bank.song(songIndex));
+	});
+	fmt::print("\t{:<10} {:8.1f} MB/s  {:8.2f} Mrows/s\n", "convert",
+		(double(rom.bankSize)*iterations / (1024*1024)) / convertTime,
+		(double(rowCount)*iterations / 1e6) / convertTime);
+
+	// writing the bank back out, then checking that it decodes to the same songs and writes out the same again
+	std::vector<uint8_t> encoded;
+	double const encodeTime = timeIterations(iterations, [&]() {
+		encoded = bank.serialize();
+	});
+	GBAMusicBank reencoded(ByteView(encoded.data(), encoded.size()), 0);
+	bool roundTrips = (reencoded.songCount() == bank.songCount()) && (reencoded.serialize() == encoded);
+	for (size_t songIndex = 0; roundTrips && songIndex < bank.songCount(); ++songIndex)
+	{
+		GBASong const& original = bank.song(songIndex);
+		GBASong const& decoded = reencoded.song(songIndex);
+		roundTrips &= (decoded.patternOrder == original.patternOrder) && (decoded.patterns.size() == original.patterns.size());
+		for (size_t patternIndex = 0; roundTrips && patternIndex < original.patterns.size(); ++patternIndex)
+		{
+			Span<SharedCell const> const a = original.patterns[patternIndex].cells();
+			Span<SharedCell const> const b = decoded.patterns[patternIndex].cells();
+			roundTrips &= (a.size() == b.size()) && memcmp(a.data(), b.data(), a.size()*sizeof(SharedCell)) == 0;
+		}
+	}
+	fmt::print("\t{:<10} {:8.1f} MB/s  {:8.2f} Mrows/s  ({:.1f} MB re-encoded){}\n", "encode",
+		(double(encoded.size())*iterations / (1024*1024)) / encodeTime,
+		(double(rowCount)*iterations / 1e6) / encodeTime,
+		encoded.size() / (1024.0*1024.0),
+		roundTrips ? "" : "  ROUND TRIP MISMATCH");
+
+	size_t serializedBytes = 0;
+	double const serializeTime = timeIterations(iterations, [&]() {
+		serializedBytes = 0;
+		for (XMFile const& module : modules)
+			serializedBytes += module.serialize().size();
+	});
+	fmt::print("\t{:<10} {:8.1f} MB/s  {:8.2f} Mrows/s  ({:.1f} MB of xm)\n", "serialize",
+		(double(serializedBytes)*iterations / (1024*1024)) / serializeTime,
+		(double(rowCount)*iterations / 1e6) / serializeTime,
+		serializedBytes / (1024.0*1024.0));
+}
+
+int main(int argc, char** argv)
+{
+	SyntheticBankOptions options;
+	bool pipelineOnly = false;
+
+	for (int argIndex = 1; argIndex < argc; ++argIndex)
+	{
+		char const* arg = argv[argIndex];
+
+		// every option but --pipeline-only takes a number within the given range
+		auto nextNumber = [&](int64_t min, int64_t max) {
+			char const* valueStr = argv[++argIndex];
+			int64_t value = 0;
+			if (!tryParseNumber(valueStr, &value) || value < min || value > max)
+			{
+				fmt::print(stderr, "{} must be a number from {} to {}, not '{}'\n", arg, min, max, valueStr);
+				exit(1);
+			}
+			return value;
+		};
+
+		bool const hasValue = argIndex+1 < argc;
+		if (strcmp(arg, "--pipeline-only") == 0)
+			pipelineOnly = true;
+		else if (strcmp(arg, "--songs") == 0 && hasValue)
+			options.songCount = int(nextNumber(1, 255));
+		else if (strcmp(arg, "--patterns") == 0 && hasValue)
+			options.patternsPerSong = int(nextNumber(1, 255));
+		else if (strcmp(arg, "--rows") == 0 && hasValue)
+			options.rowsPerPattern = int(nextNumber(1, 256));
+		else if (strcmp(arg, "--channels") == 0 && hasValue)
+			options.channelCount = int(nextNumber(1, 32));
+		else if (strcmp(arg, "--instruments") == 0 && hasValue)
+			options.instrumentCount = int(nextNumber(1, 255));
+		else if (strcmp(arg, "--sample-length") == 0 && hasValue)
+			options.sampleLength = uint32_t(nextNumber(0, 16*1024*1024));
+		else if (strcmp(arg, "--rom-size") == 0 && hasValue)
+			options.romSize = size_t(nextNumber(1, 1024))*1024*1024;
+		else if (strcmp(arg, "--iterations") == 0 && hasValue)
+			options.iterations = int(nextNumber(1, 1000));
+		else
+		{
+			fmt::print(stderr, "usage: bench [--pipeline-only] [--songs N] [--patterns N] [--rows N] [--channels N] [--instruments N] [--sample-length bytes] [--rom-size MB] [--iterations N]\n");
+			exit(1);
+		}
+	}
+
+	if (!pipelineOnly)
+	{
+		benchRowDecode();
+		benchDelta();
+	}
+	benchPipeline(options);
+	return 0;
+}
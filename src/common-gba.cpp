@@ -1,14 +1,29 @@
+#include <algorithm>
 #include <fmt/core.h>
-#include "misc.h"
 #include "common-gba.h"
+#include "misc.h"
+#include "row-decode.h"
+#include "trace.h"
 
-GBAMusicBank::GBAMusicBank(FILE* fh, size_t baseAddr)
+GBAMusicBank::GBAMusicBank(ByteView rom, size_t baseAddr, SampleStorage sampleStorage)
 {
-	fseek(fh, baseAddr, SEEK_SET);
+	TRACE_SCOPE("parse bank");
 
-	gba_musicbank_header_t const bankHeader = read<gba_musicbank_header_t>(fh);
+	this->rom = rom;
+	this->baseAddr = baseAddr;
 
-	std::vector<uint32_t> songOffsets = readArray<uint32_t>(fh, bankHeader.songCount);
+	ByteReader reader(rom, baseAddr);
+
+	gba_musicbank_header_t const bankHeader = reader.read<gba_musicbank_header_t>();
+
+	this->songOffsets = reader.readArray<uint32_t>(bankHeader.songCount);
+	countAdd(Counter::DiscontiguousReads, 1);
+	countAdd(Counter::BytesTouched, sizeof(bankHeader) + this->songOffsets.size()*sizeof(uint32_t));
+	if (reader.overrun)
+	{
+		this->truncated = true;
+		return;
+	}
 
 	this->instruments.resize(bankHeader.instrumentCount);
 
@@ -16,88 +31,162 @@ GBAMusicBank::GBAMusicBank(FILE* fh, size_t baseAddr)
 	{
 		GBAInstrument& instrument = this->instruments[instrIndex];
 		{
-			instrument.header = read<gba_instrument_header_t>(fh);
-			instrument.sample = readArray<int8_t>(fh, instrument.header.sampleLength);
-			falign(fh, 4);
+			instrument.header = reader.read<gba_instrument_header_t>();
+
+			int8_t const* sampleData = reinterpret_cast<int8_t const*>(reader.take(instrument.header.sampleLength));
+			if (sampleData)
+			{
+				if (sampleStorage == SampleStorage::Copy)
+				{
+					instrument.ownedSample.assign(sampleData, sampleData+instrument.header.sampleLength);
+					sampleData = instrument.ownedSample.data();
+					countAdd(Counter::BytesTouched, instrument.header.sampleLength);
+					countAdd(Counter::SamplesCopied, instrument.header.sampleLength);
+				}
+				instrument.sample = Span<int8_t const>(sampleData, instrument.header.sampleLength);
+			}
+			reader.align(4);
 		}
 	}
 
-	this->songs.resize(bankHeader.songCount);
+	this->truncated |= reader.overrun;
+	this->songs.resize(this->songOffsets.size());
+	countAdd(Counter::BytesTouched, this->instruments.size()*sizeof(gba_instrument_header_t));
 
-	for (uint32_t songIndex = 0; songIndex < bankHeader.songCount; ++songIndex)
+	if (sampleStorage == SampleStorage::Copy)
 	{
-		fseek(fh, baseAddr+songOffsets[songIndex], SEEK_SET);
-
-		GBASong& song = this->songs[songIndex];
+		for (size_t songIndex = 0; songIndex < this->songCount(); ++songIndex)
 		{
-			song.header = read<gba_song_header_t>(fh);
-			falign(fh, 4);
+			this->song(songIndex);
+		}
+		this->rom = ByteView();
+	}
+}
+
+GBASong const& GBAMusicBank::song(size_t songIndex)
+{
+	std::lock_guard<std::mutex> lock(*this->decodeMutex);
+
+	std::optional<GBASong>& song = this->songs[songIndex];
+	if (!song)
+	{
+		song.emplace();
+		this->decodeSong(songIndex, *song);
+	}
+	return *song;
+}
+
+bool GBAMusicBank::isTruncated() const
+{
+	std::lock_guard<std::mutex> lock(*this->decodeMutex);
+	return this->truncated;
+}
+
+void GBAMusicBank::decodeSong(uint32_t songIndex, GBASong& song)
+{
+	TRACE_SCOPE_ARG("decode song", "song", songIndex);
+
+	ByteReader reader(this->rom, this->baseAddr+this->songOffsets[songIndex]);
 
-			song.patternOrder = readArray<uint8_t>(fh, song.header.songLength);
-			falign(fh, 4);
+	song.header = reader.read<gba_song_header_t>();
+	reader.align(4);
 
-			song.patterns.resize(song.header.patternCount);
+	song.patternOrder = reader.readArray<uint8_t>(song.header.songLength);
+	reader.align(4);
 
-			for (uint32_t patternIndex = 0; patternIndex < song.header.patternCount; ++patternIndex)
+	song.patterns.resize(song.header.patternCount);
+
+	// rows are read in two passes. the first walks the pattern tables and notes where every row lives,
+	// and the second decodes them in offset order, so the row data is read in one forward sweep
+	// rather than hopping back and forth across the rom for every row.
+	struct RowReference {
+		uint32_t offset;
+		uint8_t patternIndex;
+		uint16_t rowIndex;
+	};
+	std::vector<RowReference> rowReferences;
+	uint64_t zeroRows = 0;
+	uint64_t cells = 0;
+
+	for (uint32_t patternIndex = 0; patternIndex < song.header.patternCount; ++patternIndex)
+	{
+		SharedPattern& pattern = song.patterns[patternIndex];
+
+		uint16_t rowCount = reader.readU16();
+		reader.align(4);
+
+		pattern.resize(rowCount, song.header.channelCount);
+		cells += pattern.cells().size();
+
+		for (uint32_t rowIndex = 0; rowIndex < rowCount; ++rowIndex)
+		{
+			uint32_t const rowDataOffset = reader.readU32();
+
+			// empty rows are encoded as a zero offset, rather than an explicit offset to an empty row
+			if (rowDataOffset == 0)
 			{
-				SharedPattern& pattern = song.patterns[patternIndex];
+				zeroRows++;
+				continue;
+			}
 
-				uint16_t rowCount = readU16(fh);
-				falign(fh, 4);
+			rowReferences.push_back({ rowDataOffset, uint8_t(patternIndex), uint16_t(rowIndex) });
+		}
+	}
 
-				pattern.rows.resize(rowCount);
+	this->truncated |= reader.overrun;
+	this->referencedRowCount += rowReferences.size();
 
-				for (uint32_t rowIndex = 0; rowIndex < rowCount; ++rowIndex)
-				{
-					SharedRow& row = pattern.rows[rowIndex];
-					row.cells.resize(song.header.channelCount);
-
-					uint32_t const rowDataOffset = readU32(fh);
-
-					// empty rows are encoded as a zero offset, rather than an explicit offset to an empty row
-					if (rowDataOffset == 0)
-						continue;
-
-					size_t const currPos = ftell(fh);
-
-					fseek(fh, baseAddr+rowDataOffset, SEEK_SET);
-
-					std::vector<uint8_t> bitmask = readArray<uint8_t>(fh, ((song.header.channelCount*5)+7)/8);
-
-					for (uint32_t channel = 0; channel < song.header.channelCount; ++channel)
-					{
-						SharedCell& cell = row.cells[channel];
-
-						int const bitPosNote       = channel*5+0;
-						int const bitPosInstrument = channel*5+1;
-						int const bitPosVolume     = channel*5+2;
-						int const bitPosEffect     = channel*5+3;
-						int const bitPosParam      = channel*5+4;
-
-						if (bitmask[bitPosNote/8] & (0x80>>(bitPosNote%8)))
-						{
-							cell.note = readU8(fh);
-						}
-						if (bitmask[bitPosInstrument/8] & (0x80>>(bitPosInstrument%8)))
-						{
-							cell.inst = readU8(fh);
-						}
-						if (bitmask[bitPosVolume/8] & (0x80>>(bitPosVolume%8)))
-						{
-							cell.vol = readU8(fh);
-						}
-						if (bitmask[bitPosEffect/8] & (0x80>>(bitPosEffect%8)))
-						{
-							cell.effect = readU8(fh);
-						}
-						if (bitmask[bitPosParam/8] & (0x80>>(bitPosParam%8)))
-						{
-							cell.param = readU8(fh);
-						}
-					}
-
-					fseek(fh, currPos, SEEK_SET);
-				}
+	// the header, pattern order and row tables are contiguous
+	uint64_t bytesTouched = reader.pos - (this->baseAddr+this->songOffsets[songIndex]);
+	uint64_t discontiguousReads = 1;
+	uint64_t rowsDecoded = 0;
+
+	std::sort(rowReferences.begin(), rowReferences.end(), [](RowReference const& a, RowReference const& b) {
+		return a.offset < b.offset;
+	});
+
+	{
+		TRACE_SCOPE_ARG("decode rows", "rows", rowReferences.size());
+		size_t nextRowAddr = 0;
+		for (RowReference const& ref : rowReferences)
+		{
+			// rows are heavily reused within and across songs, so only decode each one once
+			uint64_t const rowKey = (uint64_t(ref.offset) << 8) | song.header.channelCount;
+			auto cached = this->rowCache.find(rowKey);
+			if (cached == this->rowCache.end())
+			{
+				size_t const cellIndex = this->cachedCells.size();
+				this->cachedCells.resize(cellIndex + song.header.channelCount);
+				size_t const rowAddr = this->baseAddr+ref.offset;
+				size_t const available = (rowAddr < this->rom.size) ? this->rom.size-rowAddr : 0;
+				this->truncated |= !decodeRow(available ? this->rom.data+rowAddr : nullptr, available, song.header.channelCount, this->cachedCells.data()+cellIndex);
+				cached = this->rowCache.emplace(rowKey, cellIndex).first;
+
+				size_t const rowSize = available ? packedRowSize(this->rom.data+rowAddr, available, song.header.channelCount) : 0;
+				discontiguousReads += (rowAddr != nextRowAddr);
+				nextRowAddr = rowAddr+rowSize;
+				bytesTouched += rowSize;
+				rowsDecoded++;
+			}
+			std::copy_n(this->cachedCells.begin()+cached->second, song.header.channelCount, song.patterns[ref.patternIndex].row(ref.rowIndex).begin());
+		}
+	}
+	this->uniqueRowCount = this->rowCache.size();
+
+	countAdd(Counter::BytesTouched, bytesTouched);
+	countAdd(Counter::DiscontiguousReads, discontiguousReads);
+	countAdd(Counter::RowsDecoded, rowsDecoded);
+	countAdd(Counter::ZeroRowsSkipped, zeroRows);
+	countAdd(Counter::CellsMaterialized, cells);
+
+	{
+		TRACE_SCOPE("scan instrument usage");
+		for (SharedPattern const& pattern : song.patterns)
+		{
+			for (SharedCell const& cell : pattern.cells())
+			{
+				if (cell.inst)
+					song.usedInstruments[cell.inst-1] = true;
 			}
 		}
 	}
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <bitset>
 #include <cstdio>
 #include <cstdint>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include "common.h"
+#include "mapped-file.h"
 
 struct gba_musicbank_header_t {
 	uint16_t version;
@@ -60,7 +66,10 @@ static_assert(sizeof(gba_song_header_t) == 6);
 
 struct GBAInstrument {
 	gba_instrument_header_t header;
-	std::vector<int8_t> sample;
+
+	// signed 8-bit PCM. points either into the rom, or into ownedSample.
+	Span<int8_t const> sample;
+	std::vector<int8_t> ownedSample;
 };
 
 
@@ -68,12 +77,78 @@ struct GBASong {
 	gba_song_header_t header;
 	std::vector<uint8_t> patternOrder;
 	std::vector<SharedPattern> patterns;
+
+	// which instruments any pattern refers to, indexed from zero rather than one
+	std::bitset<256> usedInstruments;
+};
+
+
+enum class SampleStorage {
+	View, // samples point straight into the rom, which must outlive the bank
+	Copy, // samples are copied, so the bank can outlive the rom
 };
 
 
+// the bank header and instruments are read up front, and each song is decoded the first time it's asked for
 struct GBAMusicBank {
 	std::vector<GBAInstrument> instruments;
-	std::vector<GBASong> songs;
 
-	GBAMusicBank(FILE* fh, size_t baseAddr);
+	// set if any part of the bank lay outside the rom.
+	// this only covers songs that have been decoded so far, so check it after calling song().
+	bool truncated = false;
+
+	// non-empty row references across the decoded songs, and how many distinct rows they pointed at
+	size_t referencedRowCount = 0;
+	size_t uniqueRowCount = 0;
+
+	// in View mode the rom must outlive the bank, as songs are decoded from it later.
+	// in Copy mode every song is decoded immediately, so the bank has no further use for the rom.
+	GBAMusicBank(ByteView rom, size_t baseAddr, SampleStorage sampleStorage = SampleStorage::View);
+
+	// copying would leave copied samples pointing at the original's storage
+	GBAMusicBank(GBAMusicBank const&) = delete;
+	GBAMusicBank& operator=(GBAMusicBank const&) = delete;
+	GBAMusicBank(GBAMusicBank&&) = default;
+	GBAMusicBank& operator=(GBAMusicBank&&) = default;
+
+	size_t songCount() const { return this->songs.size(); }
+	size_t address() const { return this->baseAddr; }
+
+	// decodes the song if it hasn't been already. safe to call from several threads at once.
+	GBASong const& song(size_t songIndex);
+
+	// `truncated`, for when other threads may be decoding songs at the same time
+	bool isTruncated() const;
+
+	// the bank in the rom's own format, with offsets relative to its start, so it can be placed at any 4-aligned address.
+	// identical rows are stored once and empty rows as a zero offset, so this is often smaller than the original.
+	// decoding what's written gives back exactly the same songs. every song is decoded first.
+	std::vector<uint8_t> serialize();
+	bool save(FILE* fh);
+
+	// a snapshot is everything the bank decodes to, laid out so that loading it is little more than a few copies.
+	// saving decodes every song first. the cart's fourcc goes along with it, so exports can still be named.
+	bool saveSnapshot(FILE* fh, std::string const& fourcc);
+
+	// returns nothing if this isn't a snapshot, or is from an incompatible version.
+	// samples point into the snapshot, which must outlive the bank, as in View mode.
+	static std::optional<GBAMusicBank> loadSnapshot(ByteView snapshot, std::string* fourcc);
+
+private:
+	GBAMusicBank() = default;
+
+	ByteView rom;
+	size_t baseAddr = 0;
+	std::vector<uint32_t> songOffsets;
+	std::vector<std::optional<GBASong>> songs;
+
+	// decoded rows, keyed by offset and channel count, and stored back-to-back in one buffer.
+	// shared between songs, since they often reuse each other's rows.
+	std::unordered_map<uint64_t, size_t> rowCache;
+	std::vector<SharedCell> cachedCells;
+
+	// guards everything above, and the public counters
+	std::unique_ptr<std::mutex> decodeMutex = std::make_unique<std::mutex>();
+
+	void decodeSong(uint32_t songIndex, GBASong& song);
 };
@@ -1,6 +1,9 @@
 #include <cstdlib>
+#include <cstring>
 #include "common-xm.h"
+#include "delta.h"
 #include "misc.h"
+#include "trace.h"
 #include <fmt/core.h>
 
 XMFile::XMFile()
@@ -32,19 +35,17 @@ XMFile::XMFile(FILE* fh)
 
 		xm_pattern_header_t const patternHeader = read<xm_pattern_header_t>(fh);
 
-		pattern.rows.resize(patternHeader.rowCount);
+		pattern.resize(patternHeader.rowCount, xmHeader.channelCount);
 
 		for (int rowIndex = 0; rowIndex < patternHeader.rowCount; ++rowIndex)
 		{
-			SharedRow& row = pattern.rows[rowIndex];
-
-			row.cells.resize(xmHeader.channelCount);
+			Span<SharedCell> const row = pattern.row(rowIndex);
 
 			if (patternHeader.packedDataSize != 0)
 			{
 				for (int channel = 0; channel < xmHeader.channelCount; ++channel)
 				{
-					SharedCell& cell = row.cells[channel];
+					SharedCell& cell = row[channel];
 
 					uint8_t const bits = readU8(fh);
 					if (bits & 0x80)
@@ -109,101 +110,154 @@ XMFile::XMFile(FILE* fh)
 			sample.relativeNoteNumber = sampleHeader.relativeNoteNumber;
 			sample.name = std::string(sampleHeader.name, sampleHeader.name+sizeof(sampleHeader.name));
 
-			sample.data = readArray<int8_t>(fh, sampleHeader.sampleLength);
+			std::vector<int8_t> pcm = readArray<int8_t>(fh, sampleHeader.sampleLength);
+			deltaDecode(pcm.data(), pcm.data(), pcm.size());
+			sample.storage = std::make_shared<std::vector<int8_t>>(std::move(pcm));
+			sample.data = Span<int8_t const>(sample.storage->data(), sample.storage->size());
 		}
 	}
 }
 
-void XMFile::save(FILE* fh) const
+namespace
 {
-	xm_header_t xmHeader;
+	template<typename T> uint8_t* put(uint8_t* out, T const& value)
+	{
+		memcpy(out, &value, sizeof(T));
+		return out+sizeof(T);
+	}
+
+	// how many bytes the XM packing scheme turns this pattern into
+	size_t packedPatternSize(SharedPattern const& pattern)
 	{
+		size_t size = 0;
+		for (SharedCell const& cell : pattern.cells())
+		{
+			int const fieldCount = (cell.note != 0) + (cell.inst != 0) + (cell.vol != 0) + (cell.effect != 0) + (cell.param != 0);
+
+			// a fully-populated cell is stored raw, anything else gets a leading bitfield
+			size += (fieldCount == 5) ? 5 : 1+fieldCount;
+		}
+		return size;
+	}
+
+	uint8_t* packPattern(SharedPattern const& pattern, uint8_t* out)
+	{
+		for (SharedCell const& cell : pattern.cells())
+		{
+			uint8_t bits = 0;
+			if (cell.note)   bits |= 0x01;
+			if (cell.inst)   bits |= 0x02;
+			if (cell.vol)    bits |= 0x04;
+			if (cell.effect) bits |= 0x08;
+			if (cell.param)  bits |= 0x10;
+
+			if (bits == 0x1f)
+			{
+				*out++ = cell.note;
+				*out++ = cell.inst;
+				*out++ = cell.vol;
+				*out++ = cell.effect;
+				*out++ = cell.param;
+			}
+			else
+			{
+				bits |= 0x80;
+				*out++ = bits;
+				if (cell.note)   *out++ = cell.note;
+				if (cell.inst)   *out++ = cell.inst;
+				if (cell.vol)    *out++ = cell.vol;
+				if (cell.effect) *out++ = cell.effect;
+				if (cell.param)  *out++ = cell.param;
+			}
+		}
+		return out;
+	}
+
+	xm_header_t makeHeader(XMFile const& module, size_t patternCount, size_t instrumentCount)
+	{
+		xm_header_t xmHeader;
+		memset(&xmHeader, 0, sizeof(xmHeader));
+
 		memcpy(xmHeader.idText, "Extended Module: ", sizeof(xmHeader.idText));
 
-		if (this->moduleName.length() > sizeof(xmHeader.moduleName))
+		if (module.moduleName.length() > sizeof(xmHeader.moduleName))
 		{
 			fputs("Module name is too long!\n", stderr);
 			exit(1);
 		}
-		memset(xmHeader.moduleName, 0, sizeof(xmHeader.moduleName));
-		memcpy(xmHeader.moduleName, this->moduleName.c_str(), this->moduleName.length());
+		memcpy(xmHeader.moduleName, module.moduleName.c_str(), module.moduleName.length());
 
 		xmHeader.always1a = 0x1a;
 
-		if (this->trackerName.length() > sizeof(xmHeader.trackerName))
+		if (module.trackerName.length() > sizeof(xmHeader.trackerName))
 		{
 			fputs("Tracker name is too long!\n", stderr);
 			exit(1);
 		}
-		memset(xmHeader.trackerName, 0, sizeof(xmHeader.trackerName));
-		memcpy(xmHeader.trackerName, this->trackerName.c_str(), this->trackerName.length());
+		memcpy(xmHeader.trackerName, module.trackerName.c_str(), module.trackerName.length());
 
 		xmHeader.versionNumber = 0x0104;
 		xmHeader.headerSize = 276;
-		xmHeader.songLength = this->patternOrder.size();
-		xmHeader.songRestartPos = this->songRestartPos;
-		xmHeader.channelCount = this->channelCount;
-		xmHeader.patternCount = this->patterns.size();
-		xmHeader.instrumentCount = this->instruments.size();
-		xmHeader.frequencyTableFlags = this->frequencyTableFlags;
-		xmHeader.defaultTickrate = this->defaultTickrate;
-		xmHeader.defaultTempo = this->defaultTempo;
-
-		if (this->patternOrder.size() > sizeof(xmHeader.patternOrderTable))
+		xmHeader.songLength = module.patternOrder.size();
+		xmHeader.songRestartPos = module.songRestartPos;
+		xmHeader.channelCount = module.channelCount;
+		xmHeader.patternCount = patternCount;
+		xmHeader.instrumentCount = instrumentCount;
+		xmHeader.frequencyTableFlags = module.frequencyTableFlags;
+		xmHeader.defaultTickrate = module.defaultTickrate;
+		xmHeader.defaultTempo = module.defaultTempo;
+
+		if (module.patternOrder.size() > sizeof(xmHeader.patternOrderTable))
 		{
 			fputs("Pattern order table is too long!\n", stderr);
 			exit(1);
 		}
-		memcpy(xmHeader.patternOrderTable, this->patternOrder.data(), this->patternOrder.size());
+		memcpy(xmHeader.patternOrderTable, module.patternOrder.data(), module.patternOrder.size());
+
+		return xmHeader;
 	}
-	write<xm_header_t>(fh, xmHeader);
 
-	for (SharedPattern const& pattern : this->patterns)
+	size_t serializedPatternSize(SharedPattern const& pattern)
 	{
-		std::vector<uint8_t> packedData;
-		for (SharedRow const& row : pattern.rows)
-		{
-			for (SharedCell const& cell : row.cells)
-			{
-				uint8_t bits = 0;
-				if (cell.note)   bits |= 0x01;
-				if (cell.inst)   bits |= 0x02;
-				if (cell.vol)    bits |= 0x04;
-				if (cell.effect) bits |= 0x08;
-				if (cell.param)  bits |= 0x10;
-
-				if (bits == 0x1f)
-				{
-					packedData.push_back(cell.note);
-					packedData.push_back(cell.inst);
-					packedData.push_back(cell.vol);
-					packedData.push_back(cell.effect);
-					packedData.push_back(cell.param);
-				}
-				else
-				{
-					bits |= 0x80;
-					packedData.push_back(bits);
-					if (cell.note)   packedData.push_back(cell.note);
-					if (cell.inst)   packedData.push_back(cell.inst);
-					if (cell.vol)    packedData.push_back(cell.vol);
-					if (cell.effect) packedData.push_back(cell.effect);
-					if (cell.param)  packedData.push_back(cell.param);
-				}
-			}
-		}
+		return sizeof(xm_pattern_header_t) + packedPatternSize(pattern);
+	}
+
+	// no cell packs to more than its five raw bytes
+	size_t maxSerializedPatternSize(SharedPattern const& pattern)
+	{
+		return sizeof(xm_pattern_header_t) + pattern.cells().size()*sizeof(SharedCell);
+	}
+
+	// the data is packed first and the header filled in after, so the pattern is only walked once.
+	// `out` needs room for serializedPatternSize() bytes, or maxSerializedPatternSize() if that isn't known.
+	uint8_t* serializePattern(SharedPattern const& pattern, uint8_t* out)
+	{
+		uint8_t* const end = packPattern(pattern, out+sizeof(xm_pattern_header_t));
 
 		xm_pattern_header_t patternHeader;
 		patternHeader.headerSize = 0x9;
 		patternHeader.packingType = 0;
-		patternHeader.rowCount = pattern.rows.size();
-		patternHeader.packedDataSize = packedData.size();
+		patternHeader.rowCount = pattern.rowCount();
+		patternHeader.packedDataSize = end - (out+sizeof(xm_pattern_header_t));
+		put(out, patternHeader);
+		return end;
+	}
 
-		write<xm_pattern_header_t>(fh, patternHeader);
-		writeArray<uint8_t>(fh, packedData);
+	size_t serializedInstrumentSize(XMInstrument const& inst)
+	{
+		size_t size = sizeof(xm_instrument_header_t);
+		if (inst.samples.size() > 0)
+		{
+			size += sizeof(xm_instrument_extended_header_t);
+		}
+		for (XMSample const& sample : inst.samples)
+		{
+			size += sizeof(xm_sample_header_t) + sample.data.size();
+		}
+		return size;
 	}
 
-	for (XMInstrument const& inst : this->instruments)
+	uint8_t* serializeInstrument(XMInstrument const& inst, uint8_t* out)
 	{
 		xm_instrument_header_t instHeader;
 		{
@@ -224,13 +278,11 @@ void XMFile::save(FILE* fh) const
 			instHeader.type = inst.type;
 			instHeader.sampleCount = inst.samples.size();
 		}
-		write<xm_instrument_header_t>(fh, instHeader);
+		out = put(out, instHeader);
 
 		if (inst.samples.size() > 0)
 		{
-			xm_instrument_extended_header_t instHeaderExt;
-			instHeaderExt = inst.extHeader;
-			write<xm_instrument_extended_header_t>(fh, instHeaderExt);
+			out = put(out, inst.extHeader);
 		}
 
 		for (XMSample const& sample : inst.samples)
@@ -255,12 +307,91 @@ void XMFile::save(FILE* fh) const
 				memset(sampleHeader.name, 0, sizeof(sampleHeader.name));
 				memcpy(sampleHeader.name, sample.name.c_str(), sample.name.length());
 			}
-			write<xm_sample_header_t>(fh, sampleHeader);
+			out = put(out, sampleHeader);
 		}
 
 		for (XMSample const& sample : inst.samples)
 		{
-			writeArray(fh, sample.data);
+			deltaEncode(sample.data.data(), reinterpret_cast<int8_t*>(out), sample.data.size());
+			out += sample.data.size();
+			countAdd(Counter::SamplesCopied, sample.data.size());
 		}
+		return out;
 	}
 }
+
+size_t XMFile::serializedSize() const
+{
+	size_t totalSize = sizeof(xm_header_t);
+	for (SharedPattern const& pattern : this->patterns)
+	{
+		totalSize += serializedPatternSize(pattern);
+	}
+	for (XMInstrument const& inst : this->instruments)
+	{
+		totalSize += serializedInstrumentSize(inst);
+	}
+	return totalSize;
+}
+
+void XMFile::serializeInto(uint8_t* out) const
+{
+	out = put(out, makeHeader(*this, this->patterns.size(), this->instruments.size()));
+	for (SharedPattern const& pattern : this->patterns)
+	{
+		out = serializePattern(pattern, out);
+	}
+	for (XMInstrument const& inst : this->instruments)
+	{
+		out = serializeInstrument(inst, out);
+	}
+}
+
+std::vector<uint8_t> XMFile::serialize() const
+{
+	// work out exactly how big the file will be, so it can be written in one go
+	std::vector<uint8_t> bytes(this->serializedSize());
+	this->serializeInto(bytes.data());
+	return bytes;
+}
+
+bool XMFile::save(FILE* fh) const
+{
+	TRACE_SCOPE("save xm");
+
+	std::vector<uint8_t> const bytes = this->serialize();
+	size_t const written = fwrite(bytes.data(), 1, bytes.size(), fh);
+	countAdd(Counter::BytesWritten, written);
+	return written == bytes.size();
+}
+
+XMStreamWriter::XMStreamWriter(FILE* fh)
+	: fh(fh)
+{
+}
+
+bool XMStreamWriter::writeHeader(XMFile const& module, size_t patternCount, size_t instrumentCount)
+{
+	xm_header_t const xmHeader = makeHeader(module, patternCount, instrumentCount);
+	size_t const written = fwrite(&xmHeader, 1, sizeof(xmHeader), this->fh);
+	countAdd(Counter::BytesWritten, written);
+	return written == sizeof(xmHeader);
+}
+
+bool XMStreamWriter::writePattern(SharedPattern const& pattern)
+{
+	this->buffer.resize(maxSerializedPatternSize(pattern));
+	size_t const size = serializePattern(pattern, this->buffer.data()) - this->buffer.data();
+	size_t const written = fwrite(this->buffer.data(), 1, size, this->fh);
+	countAdd(Counter::BytesWritten, written);
+	return written == size;
+}
+
+bool XMStreamWriter::writeInstrument(XMInstrument const& inst)
+{
+	this->buffer.resize(serializedInstrumentSize(inst));
+	serializeInstrument(inst, this->buffer.data());
+	size_t const written = fwrite(this->buffer.data(), 1, this->buffer.size(), this->fh);
+	countAdd(Counter::BytesWritten, written);
+	return written == this->buffer.size();
+}
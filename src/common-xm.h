@@ -2,6 +2,7 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -108,7 +109,11 @@ struct XMSample {
 	uint8_t panning;
 	int8_t relativeNoteNumber;
 	std::string name;
-	std::vector<int8_t> data;
+
+	// signed 8-bit PCM, *not* delta-encoded; that happens as the file is serialized.
+	// points either at someone else's data (such as a GBA bank) or into `storage`.
+	Span<int8_t const> data;
+	std::shared_ptr<std::vector<int8_t> const> storage;
 };
 
 
@@ -134,5 +139,30 @@ struct XMFile {
 
 	XMFile();
 	XMFile(FILE* fh);
-	void save(FILE* fh) const;
+	// false if any of it couldn't be written
+	bool save(FILE* fh) const;
+
+	// the whole file as it would be saved
+	std::vector<uint8_t> serialize() const;
+
+	// as above, but into a buffer of serializedSize() bytes the caller provides
+	size_t serializedSize() const;
+	void serializeInto(uint8_t* out) const;
+};
+
+
+// writes an XM file a piece at a time, so a whole module never has to be in memory at once.
+// write the header, then exactly the promised number of patterns, then of instruments.
+// each write returns false if it couldn't all be written.
+struct XMStreamWriter {
+	XMStreamWriter(FILE* fh);
+
+	// everything but the module's patterns and instruments comes from `module`
+	bool writeHeader(XMFile const& module, size_t patternCount, size_t instrumentCount);
+	bool writePattern(SharedPattern const& pattern);
+	bool writeInstrument(XMInstrument const& inst);
+
+private:
+	FILE* fh;
+	std::vector<uint8_t> buffer;
 };
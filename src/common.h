@@ -1,9 +1,30 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 
+// a non-owning view of some contiguous items
+template<typename T> struct Span {
+	Span() = default;
+	Span(T* items, size_t count) : items(items), count(count) {}
+
+	T* data() const { return items; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	T* begin() const { return items; }
+	T* end() const { return items+count; }
+
+	T& operator[](size_t index) const { return items[index]; }
+
+private:
+	T* items = nullptr;
+	size_t count = 0;
+};
+
+
 struct SharedCell {
 	uint8_t note   = 0;
 	uint8_t inst   = 0;
@@ -13,11 +34,37 @@ struct SharedCell {
 };
 
 
-struct SharedRow {
-	std::vector<SharedCell> cells;
-};
+// a rows-by-channels grid of cells, stored row-major in a single allocation
+struct SharedPattern {
+	SharedPattern() = default;
+	SharedPattern(size_t rowCount, size_t channelCount)
+	{
+		resize(rowCount, channelCount);
+	}
 
+	// any existing cells are cleared
+	void resize(size_t rowCount, size_t channelCount)
+	{
+		this->rows = rowCount;
+		this->channels = channelCount;
+		this->cellData.assign(rowCount*channelCount, SharedCell());
+	}
 
-struct SharedPattern {
-	std::vector<SharedRow> rows;
+	size_t rowCount() const { return this->rows; }
+	size_t channelCount() const { return this->channels; }
+
+	Span<SharedCell> row(size_t rowIndex) { return Span<SharedCell>(this->cellData.data() + rowIndex*this->channels, this->channels); }
+	Span<SharedCell const> row(size_t rowIndex) const { return Span<SharedCell const>(this->cellData.data() + rowIndex*this->channels, this->channels); }
+
+	SharedCell& cell(size_t rowIndex, size_t channel) { return this->cellData[rowIndex*this->channels + channel]; }
+	SharedCell const& cell(size_t rowIndex, size_t channel) const { return this->cellData[rowIndex*this->channels + channel]; }
+
+	// every cell in the pattern, row by row
+	Span<SharedCell> cells() { return Span<SharedCell>(this->cellData.data(), this->cellData.size()); }
+	Span<SharedCell const> cells() const { return Span<SharedCell const>(this->cellData.data(), this->cellData.size()); }
+
+private:
+	size_t rows = 0;
+	size_t channels = 0;
+	std::vector<SharedCell> cellData;
 };
@@ -0,0 +1,73 @@
+#include <cstring>
+#include "content-hash.h"
+
+namespace
+{
+	uint64_t const kPrime1 = 0x9e3779b185ebca87ull;
+	uint64_t const kPrime2 = 0xc2b2ae3d27d4eb4full;
+
+	uint64_t rotl(uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64-r));
+	}
+
+	uint64_t loadU64(uint8_t const* ptr)
+	{
+		uint64_t value;
+		memcpy(&value, ptr, sizeof(value));
+		return value;
+	}
+
+	uint64_t round(uint64_t acc, uint64_t input)
+	{
+		acc += input * kPrime2;
+		acc = rotl(acc, 31);
+		return acc * kPrime1;
+	}
+
+	uint64_t finalize(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= kPrime2;
+		h ^= h >> 29;
+		h *= kPrime1;
+		h ^= h >> 32;
+		return h;
+	}
+}
+
+uint64_t contentHash(ByteView bytes)
+{
+	uint8_t const* ptr = bytes.data;
+	size_t remaining = bytes.size;
+
+	// four independent lanes, so the multiplies can overlap
+	uint64_t lanes[4] = { kPrime1+kPrime2, kPrime2, 0, 0-kPrime1 };
+	while (remaining >= 32)
+	{
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			lanes[lane] = round(lanes[lane], loadU64(ptr + lane*8));
+		}
+		ptr += 32;
+		remaining -= 32;
+	}
+
+	uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+	h += bytes.size;
+
+	while (remaining >= 8)
+	{
+		h = rotl(h ^ round(0, loadU64(ptr)), 27) * kPrime1;
+		ptr += 8;
+		remaining -= 8;
+	}
+	while (remaining > 0)
+	{
+		h = rotl(h ^ (*ptr * kPrime2), 11) * kPrime1;
+		ptr++;
+		remaining--;
+	}
+
+	return finalize(h);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include "mapped-file.h"
+
+// a fast non-cryptographic 64-bit hash of some bytes, for telling roms apart by their contents.
+// the value is stable across runs and machines, so it may be stored.
+uint64_t contentHash(ByteView bytes);
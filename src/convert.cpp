@@ -0,0 +1,153 @@
+#include <cstring>
+#include <fmt/core.h>
+#include "convert.h"
+#include "trace.h"
+#include "version.h"
+
+std::string cartFourcc(ByteView rom)
+{
+	char fourcc[5] = { 0 };
+	if (rom.contains(0xAC, 4))
+	{
+		memcpy(fourcc, rom.data+0xAC, 4);
+	}
+	return fourcc;
+}
+
+std::string songModuleName(std::string const& fourcc, size_t bankAddress, size_t songIndex)
+{
+	return fmt::format("{}-{:06X}-song{:02X}", fourcc, bankAddress, songIndex);
+}
+
+std::string converterTrackerName()
+{
+	return fmt::format("esgba2xm-{}.{}.{}", kToolVersionMajor, kToolVersionMinor, kToolVersionPatch);
+}
+
+XMFile convertHeader(GBASong const& song)
+{
+	XMFile xm;
+
+	xm.moduleName = "";
+	xm.trackerName = "";
+	xm.songRestartPos = song.header.loopPoint;
+	xm.channelCount = song.header.channelCount;
+	xm.frequencyTableFlags = 0; // TODO: figure out whether this matters
+	xm.defaultTickrate = song.header.tickrate;
+	xm.defaultTempo = song.header.tempo;
+	xm.patternOrder = song.patternOrder;
+
+	return xm;
+}
+
+XMInstrument convertInstrument(GBAMusicBank const& bank, GBASong const& song, uint32_t instIndex)
+{
+	GBAInstrument const& gbaInst = bank.instruments[instIndex];
+
+	XMInstrument xmInst;
+	{
+		xmInst.name = fmt::format("Instrument {:02x}", instIndex+1);
+		xmInst.type = 0;
+		if (gbaInst.sample.size() > 0 && song.usedInstruments[instIndex])
+		{
+			xmInst.extHeader.sampleHeaderSize = sizeof(xm_sample_header_t);
+			memset(xmInst.extHeader.sampleNumberForAllNotes, 0, sizeof(xmInst.extHeader.sampleNumberForAllNotes));
+			memcpy(xmInst.extHeader.volumeEnvelopePoints,  gbaInst.header.volumeEnvelope.points,  sizeof(xmInst.extHeader.volumeEnvelopePoints));
+			memcpy(xmInst.extHeader.panningEnvelopePoints, gbaInst.header.panningEnvelope.points, sizeof(xmInst.extHeader.panningEnvelopePoints));
+			xmInst.extHeader.volumePointCount  = gbaInst.header.volumeEnvelope.pointCount;
+			xmInst.extHeader.panningPointCount = gbaInst.header.panningEnvelope.pointCount;
+			// not certain about this:
+			//{
+				xmInst.extHeader.volumeSustainPoint    = gbaInst.header.volumeEnvelope.maybeSustainPoint;
+				xmInst.extHeader.volumeLoopStartPoint  = gbaInst.header.volumeEnvelope.maybeLoopStartPoint;
+				xmInst.extHeader.volumeLoopEndPoint    = gbaInst.header.volumeEnvelope.maybeLoopEndPoint;
+
+				xmInst.extHeader.panningSustainPoint   = gbaInst.header.panningEnvelope.maybeSustainPoint;
+				xmInst.extHeader.panningLoopStartPoint = gbaInst.header.panningEnvelope.maybeLoopStartPoint;
+				xmInst.extHeader.panningLoopEndPoint   = gbaInst.header.panningEnvelope.maybeLoopEndPoint;
+
+				xmInst.extHeader.volumeType = 0;
+				if (xmInst.extHeader.volumePointCount    != 0)    { xmInst.extHeader.volumeType  |= 0x01; /* on */ }
+				if (xmInst.extHeader.volumeSustainPoint  != 0xff) { xmInst.extHeader.volumeType  |= 0x02; /* sustain */ }
+				if (xmInst.extHeader.volumeLoopEndPoint  != 0xff) { xmInst.extHeader.volumeType  |= 0x04; /* loop */ }
+
+				xmInst.extHeader.panningType = 0;
+				if (xmInst.extHeader.panningPointCount   != 0)    { xmInst.extHeader.panningType |= 0x01; /* on */ }
+				if (xmInst.extHeader.panningSustainPoint != 0xff) { xmInst.extHeader.panningType |= 0x02; /* sustain */ }
+				if (xmInst.extHeader.panningLoopEndPoint != 0xff) { xmInst.extHeader.panningType |= 0x04; /* loop */ }
+			//}
+			xmInst.extHeader.vibratoType   = 0; // TODO: figure out what any of these do
+			xmInst.extHeader.vibratoSweep  = 0; // TODO: figure out what any of these do
+			xmInst.extHeader.vibratoDepth  = 0; // TODO: figure out what any of these do
+			xmInst.extHeader.vibratoRate   = 0; // TODO: figure out what any of these do
+			xmInst.extHeader.volumeFadeout = gbaInst.header.volumeFadeout;
+			xmInst.extHeader.reserved = 0;
+
+			XMSample xmSample;
+			{
+				xmSample.loopStart  = gbaInst.header.sampleLoopStart;
+				xmSample.loopLength = gbaInst.header.sampleLoopLength;
+				xmSample.volume     = gbaInst.header.sampleVolume;
+				xmSample.finetine   = gbaInst.header.sampleFinetune;
+
+				xmSample.typeFlags = 0;
+				if (gbaInst.header.sampleLoopLength > 0)
+				{
+					xmSample.typeFlags |= 0x01; // Forward loop
+				}
+
+				xmSample.panning = gbaInst.header.samplePanning;
+				xmSample.relativeNoteNumber = gbaInst.header.sampleRelativeNoteNumber;
+				xmSample.name = fmt::format("Sample {:02x}", instIndex+1);
+				xmSample.data = gbaInst.sample;
+			}
+			xmInst.samples.push_back(xmSample);
+		}
+	}
+	return xmInst;
+}
+
+XMFile convertSong(GBAMusicBank const& bank, GBASong const& song)
+{
+	TRACE_SCOPE("convert song");
+
+	XMFile xm = convertHeader(song);
+	xm.trackerName = converterTrackerName();
+	xm.patterns = song.patterns;
+	for (uint32_t instIndex = 0; instIndex < bank.instruments.size(); ++instIndex)
+	{
+		xm.instruments.push_back(convertInstrument(bank, song, instIndex));
+	}
+	return xm;
+}
+
+bool writeSongXM(GBAMusicBank const& bank, GBASong const& song, std::string const& moduleName, FILE* fh)
+{
+	TRACE_SCOPE("convert song");
+
+	XMFile header = convertHeader(song);
+	header.moduleName = moduleName;
+	header.trackerName = converterTrackerName();
+
+	// write the song a piece at a time, straight from the bank, rather than building a whole XMFile first
+	XMStreamWriter writer(fh);
+	if (!writer.writeHeader(header, song.patterns.size(), bank.instruments.size()))
+		return false;
+	{
+		TRACE_SCOPE_ARG("write patterns", "patterns", song.patterns.size());
+		for (SharedPattern const& pattern : song.patterns)
+		{
+			if (!writer.writePattern(pattern))
+				return false;
+		}
+	}
+	{
+		TRACE_SCOPE_ARG("write instruments", "instruments", bank.instruments.size());
+		for (uint32_t instIndex = 0; instIndex < bank.instruments.size(); ++instIndex)
+		{
+			if (!writer.writeInstrument(convertInstrument(bank, song, instIndex)))
+				return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include "common-gba.h"
+#include "common-xm.h"
+
+// the game's four-character code from the cartridge header, or an empty string if the rom is too short for one
+std::string cartFourcc(ByteView rom);
+
+// what gba2xm names a song's module and file, minus the extension
+std::string songModuleName(std::string const& fourcc, size_t bankAddress, size_t songIndex);
+
+// what gets written into the tracker name field of converted modules
+std::string converterTrackerName();
+
+// everything but the patterns and instruments, which are written out separately.
+// the module name is left empty.
+XMFile convertHeader(GBASong const& song);
+
+// only the instruments the song actually uses get their samples, the rest are left empty.
+// samples point into the bank, which must outlive the result.
+XMInstrument convertInstrument(GBAMusicBank const& bank, GBASong const& song, uint32_t instIndex);
+
+// the whole song as a module in memory, for when it isn't being streamed out with XMStreamWriter.
+// the patterns are copied, but the samples still point into the bank.
+XMFile convertSong(GBAMusicBank const& bank, GBASong const& song);
+
+// streams the song out as a complete module, holding no more than one pattern or instrument at a time.
+// returns false if it couldn't all be written, though the file may still need flushing and closing to be sure.
+bool writeSongXM(GBAMusicBank const& bank, GBASong const& song, std::string const& moduleName, FILE* fh);
@@ -0,0 +1,158 @@
+#include "delta.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define ESGBA_DELTA_SSE2 1
+#if defined(__GNUC__) || defined(__clang__)
+#define ESGBA_DELTA_AVX2 1
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define ESGBA_DELTA_NEON 1
+#endif
+
+namespace
+{
+	// the scalar loops pick up from `start`, with the byte before it as the running value
+	void encodeTail(int8_t const* src, int8_t* dst, size_t start, size_t count)
+	{
+		int8_t prev = (start > 0) ? src[start-1] : 0;
+		for (size_t i = start; i < count; ++i)
+		{
+			dst[i] = int8_t(src[i] - prev);
+			prev = src[i];
+		}
+	}
+
+	void decodeTail(int8_t const* src, int8_t* dst, size_t start, size_t count)
+	{
+		int8_t prev = (start > 0) ? dst[start-1] : 0;
+		for (size_t i = start; i < count; ++i)
+		{
+			prev = int8_t(prev + src[i]);
+			dst[i] = prev;
+		}
+	}
+
+#if ESGBA_DELTA_AVX2
+	__attribute__((target("avx2")))
+	size_t encodeAVX2(int8_t const* src, int8_t* dst, size_t count)
+	{
+		// the first byte has no predecessor to load, so leave it to the scalar loop
+		size_t i = 1;
+		for (; i+32 <= count; i += 32)
+		{
+			__m256i const curr = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src+i));
+			__m256i const prev = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src+i-1));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst+i), _mm256_sub_epi8(curr, prev));
+		}
+		return i;
+	}
+
+	bool const kHasAVX2 = __builtin_cpu_supports("avx2");
+#endif
+
+#if ESGBA_DELTA_SSE2
+	size_t encodeSSE2(int8_t const* src, int8_t* dst, size_t start, size_t count)
+	{
+		size_t i = (start > 0) ? start : 1;
+		for (; i+16 <= count; i += 16)
+		{
+			__m128i const curr = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src+i));
+			__m128i const prev = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src+i-1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), _mm_sub_epi8(curr, prev));
+		}
+		return i;
+	}
+
+	// a running sum within each 16-byte block, plus the last value of the block before it
+	size_t decodeSSE2(int8_t const* src, int8_t* dst, size_t count)
+	{
+		__m128i carry = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i+16 <= count; i += 16)
+		{
+			__m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src+i));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+			x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+			x = _mm_add_epi8(x, carry);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst+i), x);
+			carry = _mm_set1_epi8(dst[i+15]);
+		}
+		return i;
+	}
+#endif
+
+#if ESGBA_DELTA_NEON
+	size_t encodeNEON(int8_t const* src, int8_t* dst, size_t count)
+	{
+		size_t i = 1;
+		for (; i+16 <= count; i += 16)
+		{
+			vst1q_s8(dst+i, vsubq_s8(vld1q_s8(src+i), vld1q_s8(src+i-1)));
+		}
+		return i;
+	}
+
+	size_t decodeNEON(int8_t const* src, int8_t* dst, size_t count)
+	{
+		int8x16_t const zero = vdupq_n_s8(0);
+		int8x16_t carry = zero;
+		size_t i = 0;
+		for (; i+16 <= count; i += 16)
+		{
+			int8x16_t x = vld1q_s8(src+i);
+			x = vaddq_s8(x, vextq_s8(zero, x, 15));
+			x = vaddq_s8(x, vextq_s8(zero, x, 14));
+			x = vaddq_s8(x, vextq_s8(zero, x, 12));
+			x = vaddq_s8(x, vextq_s8(zero, x, 8));
+			x = vaddq_s8(x, carry);
+			vst1q_s8(dst+i, x);
+			carry = vdupq_n_s8(dst[i+15]);
+		}
+		return i;
+	}
+#endif
+}
+
+void deltaEncodeScalar(int8_t const* src, int8_t* dst, size_t count)
+{
+	encodeTail(src, dst, 0, count);
+}
+
+void deltaDecodeScalar(int8_t const* src, int8_t* dst, size_t count)
+{
+	decodeTail(src, dst, 0, count);
+}
+
+void deltaEncode(int8_t const* src, int8_t* dst, size_t count)
+{
+	if (count == 0)
+		return;
+
+	dst[0] = src[0];
+	size_t done = 1;
+#if ESGBA_DELTA_AVX2
+	if (kHasAVX2)
+		done = encodeAVX2(src, dst, count);
+#endif
+#if ESGBA_DELTA_SSE2
+	done = encodeSSE2(src, dst, done, count);
+#elif ESGBA_DELTA_NEON
+	done = encodeNEON(src, dst, count);
+#endif
+	encodeTail(src, dst, done, count);
+}
+
+void deltaDecode(int8_t const* src, int8_t* dst, size_t count)
+{
+	size_t done = 0;
+#if ESGBA_DELTA_SSE2
+	done = decodeSSE2(src, dst, count);
+#elif ESGBA_DELTA_NEON
+	done = decodeNEON(src, dst, count);
+#endif
+	decodeTail(src, dst, done, count);
+}
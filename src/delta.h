@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// XM stores samples as the difference between each byte and the one before it, starting from zero.
+
+// dst[i] = src[i] - src[i-1]. src and dst must not overlap.
+void deltaEncode(int8_t const* src, int8_t* dst, size_t count);
+
+// dst[i] = dst[i-1] + src[i], the inverse of the above. this may be done in place.
+void deltaDecode(int8_t const* src, int8_t* dst, size_t count);
+
+// plain loops, for reference and for whatever the vectorized versions leave over
+void deltaEncodeScalar(int8_t const* src, int8_t* dst, size_t count);
+void deltaDecodeScalar(int8_t const* src, int8_t* dst, size_t count);
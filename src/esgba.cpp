@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include "esgba.h"
+#include "bank-scan.h"
+#include "common-gba.h"
+#include "common-xm.h"
+#include "convert.h"
+
+struct esgba_bank {
+	GBAMusicBank bank;
+
+	esgba_bank(ByteView rom, size_t baseAddr, SampleStorage sampleStorage)
+		: bank(rom, baseAddr, sampleStorage)
+	{
+	}
+};
+
+namespace
+{
+	// nothing may throw across the C boundary, and the only thing expected to is an allocation
+	template<typename Fn>
+	esgba_status guard(Fn&& fn)
+	{
+		try
+		{
+			return fn();
+		}
+		catch (std::bad_alloc const&)
+		{
+			return ESGBA_ERROR_OUT_OF_MEMORY;
+		}
+	}
+
+	template<typename T>
+	T* allocateArray(size_t count)
+	{
+		T* ptr = static_cast<T*>(malloc(count*sizeof(T)));
+		if (!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+}
+
+int esgba_api_version(void)
+{
+	return ESGBA_API_VERSION;
+}
+
+char const* esgba_status_string(esgba_status status)
+{
+	switch (status)
+	{
+		case ESGBA_OK:                     return "ok";
+		case ESGBA_ERROR_INVALID_ARGUMENT: return "invalid argument";
+		case ESGBA_ERROR_OUT_OF_RANGE:     return "out of range";
+		case ESGBA_ERROR_OUT_OF_MEMORY:    return "out of memory";
+	}
+	return "unknown error";
+}
+
+void esgba_free(void* ptr)
+{
+	free(ptr);
+}
+
+esgba_status esgba_scan(uint8_t const* rom, size_t rom_size, int thread_count, esgba_found_bank** banks, size_t* bank_count)
+{
+	if (!rom || rom_size == 0 || thread_count < 0 || !banks || !bank_count)
+		return ESGBA_ERROR_INVALID_ARGUMENT;
+
+	if (thread_count == 0)
+		thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+	return guard([&]() {
+		std::vector<FoundBank> const found = scanForMusicBanksParallel(ByteView(rom, rom_size), thread_count, nullptr);
+
+		esgba_found_bank* out = nullptr;
+		if (!found.empty())
+		{
+			out = allocateArray<esgba_found_bank>(found.size());
+			for (size_t i = 0; i < found.size(); ++i)
+			{
+				out[i].address          = found[i].address;
+				out[i].version          = found[i].header.version;
+				out[i].instrument_count = found[i].header.instrumentCount;
+				out[i].song_count       = found[i].header.songCount;
+			}
+		}
+
+		*banks = out;
+		*bank_count = found.size();
+		return ESGBA_OK;
+	});
+}
+
+esgba_status esgba_bank_open(uint8_t const* rom, size_t rom_size, uint32_t address, uint32_t flags, esgba_bank** bank)
+{
+	if (!rom || rom_size == 0 || !bank)
+		return ESGBA_ERROR_INVALID_ARGUMENT;
+
+	// the same masking the tools do, for 08xxxxxx addresses
+	address &= 0x00ffffff;
+	if (address >= rom_size)
+		return ESGBA_ERROR_OUT_OF_RANGE;
+
+	SampleStorage const sampleStorage = (flags & ESGBA_BANK_COPY) ? SampleStorage::Copy : SampleStorage::View;
+
+	return guard([&]() {
+		*bank = new esgba_bank(ByteView(rom, rom_size), address, sampleStorage);
+		return ESGBA_OK;
+	});
+}
+
+void esgba_bank_close(esgba_bank* bank)
+{
+	delete bank;
+}
+
+size_t esgba_bank_song_count(esgba_bank const* bank)
+{
+	return bank ? bank->bank.songCount() : 0;
+}
+
+size_t esgba_bank_instrument_count(esgba_bank const* bank)
+{
+	return bank ? bank->bank.instruments.size() : 0;
+}
+
+int esgba_bank_truncated(esgba_bank* bank)
+{
+	return bank ? bank->bank.isTruncated() : 0;
+}
+
+esgba_status esgba_song_info_get(esgba_bank* bank, size_t song_index, esgba_song_info* info)
+{
+	if (!bank || !info)
+		return ESGBA_ERROR_INVALID_ARGUMENT;
+	if (song_index >= bank->bank.songCount())
+		return ESGBA_ERROR_OUT_OF_RANGE;
+
+	return guard([&]() {
+		gba_song_header_t const& header = bank->bank.song(song_index).header;
+		info->channel_count = header.channelCount;
+		info->song_length   = header.songLength;
+		info->loop_point    = header.loopPoint;
+		info->pattern_count = header.patternCount;
+		info->tickrate      = header.tickrate;
+		info->tempo         = header.tempo;
+		return ESGBA_OK;
+	});
+}
+
+esgba_status esgba_song_to_xm(esgba_bank* bank, size_t song_index, char const* module_name, uint8_t** data, size_t* size)
+{
+	if (!bank || !data || !size)
+		return ESGBA_ERROR_INVALID_ARGUMENT;
+	if (module_name && strlen(module_name) > sizeof(xm_header_t::moduleName))
+		return ESGBA_ERROR_INVALID_ARGUMENT;
+	if (song_index >= bank->bank.songCount())
+		return ESGBA_ERROR_OUT_OF_RANGE;
+
+	return guard([&]() {
+		XMFile xm = convertSong(bank->bank, bank->bank.song(song_index));
+		xm.moduleName = module_name ? module_name : "";
+
+		size_t const xmSize = xm.serializedSize();
+		uint8_t* out = allocateArray<uint8_t>(xmSize);
+		xm.serializeInto(out);
+
+		*data = out;
+		*size = xmSize;
+		return ESGBA_OK;
+	});
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+// a C interface to the bank scanner and converter, for using them in-process rather than via the tools.
+//
+// roms are always passed in as memory, and are never copied unless asked to.
+// anything the library allocates for the caller must be released with esgba_free.
+// functions that can fail return an esgba_status, and leave their outputs untouched on failure.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+	#if defined(ESGBA_BUILDING_LIBRARY)
+		#define ESGBA_API __declspec(dllexport)
+	#else
+		#define ESGBA_API __declspec(dllimport)
+	#endif
+#else
+	#define ESGBA_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bumped whenever anything below changes in a way that breaks existing callers
+#define ESGBA_API_VERSION 1
+
+typedef enum esgba_status {
+	ESGBA_OK = 0,
+	ESGBA_ERROR_INVALID_ARGUMENT, // a null pointer, an empty rom, or a module name too long for an xm
+	ESGBA_ERROR_OUT_OF_RANGE,     // the bank address or song index doesn't exist
+	ESGBA_ERROR_OUT_OF_MEMORY,
+} esgba_status;
+
+typedef struct esgba_found_bank {
+	uint32_t address;
+	uint16_t version;
+	uint8_t instrument_count;
+	uint8_t song_count;
+} esgba_found_bank;
+
+typedef struct esgba_song_info {
+	uint8_t channel_count;
+	uint8_t song_length;
+	uint8_t loop_point;
+	uint8_t pattern_count;
+	uint8_t tickrate;
+	uint8_t tempo;
+} esgba_song_info;
+
+// a loaded music bank. songs are decoded the first time they're asked for,
+// and a bank may be used from several threads at once.
+typedef struct esgba_bank esgba_bank;
+
+// bank flags
+#define ESGBA_BANK_COPY 0x1 // copy everything out of the rom, so the rom may be freed while the bank is still open
+
+// returns ESGBA_API_VERSION as it was when the library was built
+ESGBA_API int esgba_api_version(void);
+
+ESGBA_API char const* esgba_status_string(esgba_status status);
+
+ESGBA_API void esgba_free(void* ptr);
+
+// finds every music bank in the rom, in address order. thread_count 0 uses every core.
+// *banks is set to an array of *bank_count entries, or to null if there are none.
+ESGBA_API esgba_status esgba_scan(uint8_t const* rom, size_t rom_size, int thread_count, esgba_found_bank** banks, size_t* bank_count);
+
+// unless ESGBA_BANK_COPY is given, the rom must outlive the bank.
+// address may be given as a 08xxxxxx cartridge address.
+ESGBA_API esgba_status esgba_bank_open(uint8_t const* rom, size_t rom_size, uint32_t address, uint32_t flags, esgba_bank** bank);
+ESGBA_API void esgba_bank_close(esgba_bank* bank);
+
+ESGBA_API size_t esgba_bank_song_count(esgba_bank const* bank);
+ESGBA_API size_t esgba_bank_instrument_count(esgba_bank const* bank);
+
+// nonzero if any part of the bank read so far lay outside the rom
+ESGBA_API int esgba_bank_truncated(esgba_bank* bank);
+
+ESGBA_API esgba_status esgba_song_info_get(esgba_bank* bank, size_t song_index, esgba_song_info* info);
+
+// converts a song to a complete xm file in memory. module_name may be null, and may be at most 20 bytes,
+// which is all an xm header has room for; a longer one is an invalid argument.
+// *data is set to a buffer of *size bytes, to be released with esgba_free.
+ESGBA_API esgba_status esgba_song_to_xm(esgba_bank* bank, size_t song_index, char const* module_name, uint8_t** data, size_t* size);
+
+#ifdef __cplusplus
+}
+#endif
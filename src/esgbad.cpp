@@ -0,0 +1,582 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fmt/core.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "bank-print.h"
+#include "bank-scan.h"
+#include "common-gba.h"
+#include "content-hash.h"
+#include "convert.h"
+#include "lru-cache.h"
+#include "mapped-file.h"
+#include "misc.h"
+#include "thread-pool.h"
+
+// parsed banks are keyed by what's in the rom rather than where it lives,
+// so copies of the same rom share entries, and a rom that changes on disk doesn't hit stale ones.
+struct BankKey {
+	uint64_t romHash;
+	uint32_t address;
+
+	bool operator==(BankKey const& other) const
+	{
+		return romHash == other.romHash && address == other.address;
+	}
+};
+
+struct BankKeyHash {
+	size_t operator()(BankKey const& key) const
+	{
+		return size_t(key.romHash ^ (uint64_t(key.address) * 0x9e3779b97f4a7c15ull));
+	}
+};
+
+struct CachedBank {
+	// shared so a request can keep using a bank that gets evicted while it's busy
+	std::shared_ptr<GBAMusicBank> bank;
+	std::string fourcc;
+};
+
+// what a rom hashed to, and what the file looked like at the time
+struct RomIdentity {
+	FileStamp stamp;
+	uint64_t hash;
+};
+
+struct Daemon {
+	int threadCount = 1;
+
+	// guards everything below
+	std::mutex mutex;
+
+	// hashing a whole rom is cheap next to parsing it, but still worth skipping when the file hasn't changed
+	LruCache<std::string, RomIdentity> romIdentities{256};
+	LruCache<BankKey, CachedBank, BankKeyHash> banks{16};
+	LruCache<uint64_t, std::vector<FoundBank>> scans{64};
+
+	uint64_t romsHashed = 0;
+	uint64_t bankHits = 0;
+	uint64_t bankMisses = 0;
+	uint64_t scanHits = 0;
+	uint64_t scanMisses = 0;
+};
+
+// a rom named in a request. it's only opened if something actually needs its contents.
+struct RequestRom {
+	std::string path;
+	uint64_t hash = 0;
+	std::unique_ptr<MappedFile> file;
+
+	ByteView view()
+	{
+		if (!file)
+			file = std::make_unique<MappedFile>(path.c_str());
+		return file->view();
+	}
+};
+
+bool identifyRom(Daemon& daemon, char const* path, RequestRom* rom, std::string* error)
+{
+	FileStamp stamp;
+	if (!tryStatFile(path, &stamp))
+	{
+		*error = fmt::format("failed to open {} for reading", path);
+		return false;
+	}
+
+	rom->path = path;
+	{
+		std::lock_guard<std::mutex> lock(daemon.mutex);
+		RomIdentity const* known = daemon.romIdentities.find(path);
+		if (known && known->stamp == stamp)
+		{
+			rom->hash = known->hash;
+			return true;
+		}
+	}
+
+	rom->file = std::make_unique<MappedFile>(path);
+	if (!rom->file->isOpen())
+	{
+		*error = fmt::format("failed to open {} for reading", path);
+		return false;
+	}
+	rom->hash = contentHash(rom->file->view());
+
+	std::lock_guard<std::mutex> lock(daemon.mutex);
+	daemon.romIdentities.insert(path, { stamp, rom->hash });
+	daemon.romsHashed++;
+	return true;
+}
+
+CachedBank loadBank(Daemon& daemon, RequestRom& rom, uint32_t address)
+{
+	BankKey const key = { rom.hash, address };
+	{
+		std::lock_guard<std::mutex> lock(daemon.mutex);
+		if (CachedBank const* cached = daemon.banks.find(key))
+		{
+			daemon.bankHits++;
+			return *cached;
+		}
+		daemon.bankMisses++;
+	}
+
+	// copied out of the rom, so the entry doesn't depend on the file staying the same
+	ByteView const view = rom.view();
+	CachedBank loaded;
+	loaded.bank = std::make_shared<GBAMusicBank>(view, address, SampleStorage::Copy);
+	loaded.fourcc = cartFourcc(view);
+
+	std::lock_guard<std::mutex> lock(daemon.mutex);
+	daemon.banks.insert(key, loaded);
+	return loaded;
+}
+
+bool tryParseBankAddress(char const* str, uint32_t* address, std::string* error)
+{
+	int64_t value = 0;
+	if (!tryParseNumber(str, &value))
+	{
+		*error = fmt::format("failed to parse '{}' as a number", str);
+		return false;
+	}
+	// in case the user used an 08xxxxxx address, mask off the top bits
+	*address = uint32_t(value & 0x00ffffff);
+	return true;
+}
+
+// picks out the songs named with --song, or all of them if there weren't any.
+// a song named twice is only handled once, so an export doesn't write the same file twice.
+bool selectSongs(GBAMusicBank const& bank, std::vector<size_t>& songIndices, bool allByDefault, std::string* error)
+{
+	std::sort(songIndices.begin(), songIndices.end());
+	songIndices.erase(std::unique(songIndices.begin(), songIndices.end()), songIndices.end());
+
+	if (songIndices.empty() && allByDefault)
+	{
+		for (size_t songIndex = 0; songIndex < bank.songCount(); ++songIndex)
+		{
+			songIndices.push_back(songIndex);
+		}
+	}
+	for (size_t songIndex : songIndices)
+	{
+		if (songIndex >= bank.songCount())
+		{
+			*error = fmt::format("there is no song {:02x}, the bank only has {} songs", songIndex, bank.songCount());
+			return false;
+		}
+	}
+	return true;
+}
+
+// scan <rom>
+bool handleScan(Daemon& daemon, std::vector<std::string> const& args, FILE* out, std::string* error)
+{
+	if (args.size() != 2)
+	{
+		*error = "usage: scan <rom>";
+		return false;
+	}
+
+	RequestRom rom;
+	if (!identifyRom(daemon, args[1].c_str(), &rom, error))
+		return false;
+
+	std::vector<FoundBank> found;
+	bool cached = false;
+	{
+		std::lock_guard<std::mutex> lock(daemon.mutex);
+		if (std::vector<FoundBank> const* scan = daemon.scans.find(rom.hash))
+		{
+			found = *scan;
+			cached = true;
+			daemon.scanHits++;
+		}
+		else
+		{
+			daemon.scanMisses++;
+		}
+	}
+	if (!cached)
+	{
+		found = scanForMusicBanksParallel(rom.view(), daemon.threadCount);
+
+		std::lock_guard<std::mutex> lock(daemon.mutex);
+		daemon.scans.insert(rom.hash, found);
+	}
+
+	for (FoundBank const& bank : found)
+	{
+		fmt::print(out,
+			"@ {:06x}: v{:04x} {} instruments, {} songs\n",
+			bank.address,
+			bank.header.version,
+			bank.header.instrumentCount,
+			bank.header.songCount
+		);
+	}
+	return true;
+}
+
+// print <rom> <bank offset> [--song N]... [--instruments-only]
+bool handlePrint(Daemon& daemon, std::vector<std::string> const& args, FILE* out, std::string* error)
+{
+	std::vector<size_t> songIndices;
+	bool instrumentsOnly = false;
+	std::vector<std::string> positionalArgs;
+	for (size_t argIndex = 1; argIndex < args.size(); ++argIndex)
+	{
+		int64_t songIndex = 0;
+		if (args[argIndex] == "--song" && argIndex+1 < args.size())
+		{
+			if (!tryParseNumber(args[++argIndex].c_str(), &songIndex) || songIndex < 0)
+			{
+				*error = fmt::format("failed to parse '{}' as a song index", args[argIndex]);
+				return false;
+			}
+			songIndices.push_back(size_t(songIndex));
+		}
+		else if (args[argIndex] == "--instruments-only")
+		{
+			instrumentsOnly = true;
+		}
+		else
+		{
+			positionalArgs.push_back(args[argIndex]);
+		}
+	}
+	if (positionalArgs.size() != 2 || (instrumentsOnly && !songIndices.empty()))
+	{
+		*error = "usage: print <rom> <bank offset> [--song N]... [--instruments-only]";
+		return false;
+	}
+
+	uint32_t address = 0;
+	RequestRom rom;
+	if (!tryParseBankAddress(positionalArgs[1].c_str(), &address, error) || !identifyRom(daemon, positionalArgs[0].c_str(), &rom, error))
+		return false;
+
+	CachedBank const cached = loadBank(daemon, rom, address);
+	GBAMusicBank& bank = *cached.bank;
+
+	bool const printInstruments = songIndices.empty();
+	if (!selectSongs(bank, songIndices, !instrumentsOnly, error))
+		return false;
+
+	if (bank.truncated)
+	{
+		fmt::print(out, "warning: music bank at {:06x} extends past the end of {}\n", address, rom.path);
+	}
+	if (printInstruments)
+	{
+		for (uint32_t instrIndex = 0; instrIndex < bank.instruments.size(); ++instrIndex)
+		{
+			printInstrument(out, bank.instruments[instrIndex], instrIndex);
+		}
+	}
+	for (size_t songIndex : songIndices)
+	{
+		printSong(out, bank.song(songIndex), songIndex);
+	}
+	return true;
+}
+
+// export <rom> <bank offset> <output directory> [--song N]...
+bool handleExport(Daemon& daemon, std::vector<std::string> const& args, FILE* out, std::string* error)
+{
+	std::vector<size_t> songIndices;
+	std::vector<std::string> positionalArgs;
+	for (size_t argIndex = 1; argIndex < args.size(); ++argIndex)
+	{
+		int64_t songIndex = 0;
+		if (args[argIndex] == "--song" && argIndex+1 < args.size())
+		{
+			if (!tryParseNumber(args[++argIndex].c_str(), &songIndex) || songIndex < 0)
+			{
+				*error = fmt::format("failed to parse '{}' as a song index", args[argIndex]);
+				return false;
+			}
+			songIndices.push_back(size_t(songIndex));
+		}
+		else
+		{
+			positionalArgs.push_back(args[argIndex]);
+		}
+	}
+	if (positionalArgs.size() != 3)
+	{
+		*error = "usage: export <rom> <bank offset> <output directory> [--song N]...";
+		return false;
+	}
+
+	uint32_t address = 0;
+	RequestRom rom;
+	if (!tryParseBankAddress(positionalArgs[1].c_str(), &address, error) || !identifyRom(daemon, positionalArgs[0].c_str(), &rom, error))
+		return false;
+
+	CachedBank const cached = loadBank(daemon, rom, address);
+	GBAMusicBank& bank = *cached.bank;
+
+	if (!selectSongs(bank, songIndices, true, error))
+		return false;
+
+	if (bank.truncated)
+	{
+		fmt::print(out, "warning: music bank at {:06x} extends past the end of {}\n", address, rom.path);
+	}
+	for (size_t songIndex : songIndices)
+	{
+		std::string const songName = songModuleName(cached.fourcc, address, songIndex);
+		std::string const outfilePath = positionalArgs[2] + "/" + songName + ".xm";
+
+		FILE* fhOut = fopen(outfilePath.c_str(), "wb");
+		if (!fhOut)
+		{
+			*error = fmt::format("failed to open {} for writing", outfilePath);
+			return false;
+		}
+		bool const written = writeSongXM(bank, bank.song(songIndex), songName, fhOut) && !ferror(fhOut);
+		if ((fclose(fhOut) != 0) || !written)
+		{
+			*error = fmt::format("failed to write {}", outfilePath);
+			return false;
+		}
+
+		fmt::print(out, "Saving song {:02x} to {}\n", songIndex, outfilePath);
+	}
+	return true;
+}
+
+// stats
+bool handleStats(Daemon& daemon, FILE* out)
+{
+	std::lock_guard<std::mutex> lock(daemon.mutex);
+	fmt::print(out, "banks cached: {}\n", daemon.banks.size());
+	fmt::print(out, "bank hits:    {}\n", daemon.bankHits);
+	fmt::print(out, "bank misses:  {}\n", daemon.bankMisses);
+	fmt::print(out, "scan hits:    {}\n", daemon.scanHits);
+	fmt::print(out, "scan misses:  {}\n", daemon.scanMisses);
+	fmt::print(out, "roms hashed:  {}\n", daemon.romsHashed);
+	return true;
+}
+
+std::vector<std::string> splitWords(char const* line)
+{
+	std::vector<std::string> words;
+	std::string word;
+	for (char const* c = line; *c; ++c)
+	{
+		if (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')
+		{
+			if (!word.empty())
+				words.push_back(std::move(word));
+			word.clear();
+		}
+		else
+		{
+			word += *c;
+		}
+	}
+	if (!word.empty())
+		words.push_back(std::move(word));
+	return words;
+}
+
+// connections are served by a fixed set of handler threads; further clients wait in the queue and then the listen backlog
+int const kHandlerThreadCount = 8;
+
+// a client that stops sending its request, or stops reading the response, gives up its handler after this long
+int const kClientTimeoutSeconds = 30;
+
+// one request per connection: a single line in, the response out, then the connection is closed.
+// the response ends with "ok", or with a line starting "error:" if the request failed.
+void handleConnection(Daemon& daemon, int fd)
+{
+	// the response is built up in memory and sent in one go, so a client that stops reading
+	// costs one send timeout rather than one per buffer flush
+	char* response = nullptr;
+	size_t responseSize = 0;
+	FILE* in = fdopen(fd, "r");
+	FILE* out = open_memstream(&response, &responseSize);
+	if (!in || !out)
+	{
+		if (in) fclose(in); else close(fd);
+		if (out) fclose(out);
+		free(response);
+		return;
+	}
+
+	char* line = nullptr;
+	size_t lineCapacity = 0;
+	if (getline(&line, &lineCapacity, in) > 0)
+	{
+		std::vector<std::string> const args = splitWords(line);
+		std::string error;
+		bool ok = false;
+
+		if (args.empty())
+			error = "empty request";
+		else if (args[0] == "scan")
+			ok = handleScan(daemon, args, out, &error);
+		else if (args[0] == "print")
+			ok = handlePrint(daemon, args, out, &error);
+		else if (args[0] == "export")
+			ok = handleExport(daemon, args, out, &error);
+		else if (args[0] == "stats")
+			ok = handleStats(daemon, out);
+		else
+			error = fmt::format("unknown request '{}'", args[0]);
+
+		if (ok)
+			fmt::print(out, "ok\n");
+		else
+			fmt::print(out, "error: {}\n", error);
+	}
+	free(line);
+	fclose(out);
+
+	// a send that fails or times out means the client has gone; the rest of the response is dropped with it
+	for (size_t sent = 0; sent < responseSize; )
+	{
+		ssize_t const result = send(fd, response+sent, responseSize-sent, 0);
+		if (result <= 0)
+			break;
+		sent += size_t(result);
+	}
+	free(response);
+	fclose(in);
+}
+
+int main(int argc, char** argv)
+{
+	Daemon daemon;
+	std::vector<char const*> positionalArgs;
+
+	for (int argIndex = 1; argIndex < argc; ++argIndex)
+	{
+		char const* arg = argv[argIndex];
+		if (strcmp(arg, "-j") == 0 && argIndex+1 < argc)
+		{
+			char const* threadCountStr = argv[++argIndex];
+			if (!tryParseThreadCount(threadCountStr, &daemon.threadCount))
+			{
+				fmt::print(stderr, "Failed to parse '{}' as a thread count\n", threadCountStr);
+				exit(1);
+			}
+		}
+		else if (strcmp(arg, "--cache") == 0 && argIndex+1 < argc)
+		{
+			char const* cacheSizeStr = argv[++argIndex];
+			int64_t cacheSize = 0;
+			if (!tryParseNumber(cacheSizeStr, &cacheSize) || cacheSize < 1)
+			{
+				fmt::print(stderr, "Failed to parse '{}' as a cache size\n", cacheSizeStr);
+				exit(1);
+			}
+			daemon.banks = LruCache<BankKey, CachedBank, BankKeyHash>(size_t(cacheSize));
+		}
+		else
+		{
+			positionalArgs.push_back(arg);
+		}
+	}
+
+	if (positionalArgs.size() != 1)
+	{
+		fmt::print(stderr, "Expected one arg! usage:\n");
+		fmt::print(stderr, "esgbad [-j threads] [--cache banks] path/to/socket\n");
+		exit(1);
+	}
+
+	char const* socketPath = positionalArgs[0];
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+	{
+		fmt::print(stderr, "Socket path {} is too long\n", socketPath);
+		exit(1);
+	}
+	strcpy(address.sun_path, socketPath);
+
+	int const listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0)
+	{
+		fmt::print(stderr, "Failed to create a socket\n");
+		exit(1);
+	}
+
+	// a socket left behind by a previous run would stop us binding, but anything else at that path
+	// (a file given by mistake, or the socket of a daemon that's still running) is left alone
+	struct stat existing = {};
+	if (lstat(socketPath, &existing) == 0)
+	{
+		if (!S_ISSOCK(existing.st_mode))
+		{
+			fmt::print(stderr, "{} exists and isn't a socket\n", socketPath);
+			exit(1);
+		}
+
+		int const probeFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		bool const stale = probeFd >= 0
+			&& connect(probeFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+			&& errno == ECONNREFUSED;
+		if (probeFd >= 0)
+			close(probeFd);
+		if (!stale)
+		{
+			fmt::print(stderr, "{} is in use, is another esgbad already running?\n", socketPath);
+			exit(1);
+		}
+		unlink(socketPath);
+	}
+	if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 16) != 0)
+	{
+		fmt::print(stderr, "Failed to listen on {}\n", socketPath);
+		exit(1);
+	}
+
+	// a client hanging up mid-response shouldn't take the daemon down with it
+	signal(SIGPIPE, SIG_IGN);
+
+	fmt::print("Listening on {}\n", socketPath);
+	fflush(stdout);
+
+	BoundedQueue<int> clients(kHandlerThreadCount);
+	std::vector<std::thread> handlers;
+	for (int i = 0; i < kHandlerThreadCount; ++i)
+	{
+		handlers.emplace_back([&daemon, &clients]() {
+			while (std::optional<int> clientFd = clients.pop())
+				handleConnection(daemon, *clientFd);
+		});
+	}
+
+	for (;;)
+	{
+		int const clientFd = accept(listenFd, nullptr, nullptr);
+		if (clientFd < 0)
+			continue;
+
+		timeval timeout = {};
+		timeout.tv_sec = kClientTimeoutSeconds;
+		setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		clients.push(clientFd);
+	}
+}
@@ -1,174 +1,577 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <thread>
 #include <fmt/core.h>
+#include "bank-scan.h"
+#include "bank-source.h"
 #include "common-xm.h"
 #include "common-gba.h"
+#include "convert.h"
+#include "mapped-file.h"
 #include "misc.h"
-#include "version.h"
+#include "tar-archive.h"
+#include "thread-pool.h"
+#include "trace.h"
 
-XMFile convert(GBAMusicBank const& bank, GBASong const& song)
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// one rom of a batch, and the banks to export from it
+struct BatchEntry {
+	std::string path;
+	std::vector<size_t> bankAddresses; // scanned for if empty
+};
+
+// a rom that's been mapped, had its banks found, and had every song decoded, ready to be written out
+struct LoadedRom {
+	size_t entryIndex = 0;
+	std::unique_ptr<MappedFile> file;
+	std::string fourcc;
+	std::vector<GBAMusicBank> banks;
+	std::vector<std::string> errors;
+};
+
+bool readLine(FILE* fh, std::string& line)
 {
-	XMFile xm;
+	line.clear();
+	int c;
+	while ((c = fgetc(fh)) != EOF && c != '\n')
+	{
+		line += char(c);
+	}
+	return c != EOF || !line.empty();
+}
 
-	xm.moduleName = "";
-	xm.trackerName = "";
-	xm.songRestartPos = song.header.loopPoint;
-	xm.channelCount = song.header.channelCount;
-	xm.frequencyTableFlags = 0; // TODO: figure out whether this matters
-	xm.defaultTickrate = song.header.tickrate;
-	xm.defaultTempo = song.header.tempo;
-	xm.patternOrder = song.patternOrder;
-	xm.patterns = song.patterns;
+// each line is a rom path, then optionally the addresses of the banks to export from it, all separated by whitespace.
+// blank lines and lines starting with # are skipped.
+std::vector<BatchEntry> readManifest(char const* manifestPath)
+{
+	FILE* fh = fopen(manifestPath, "rb");
+	if (!fh)
+	{
+		fmt::print(stderr, "Failed to open {} for reading\n", manifestPath);
+		exit(1);
+	}
 
-	for (uint32_t instIndex = 0; instIndex < bank.instruments.size(); ++instIndex)
+	std::vector<BatchEntry> entries;
+	std::string line;
+	for (int lineNumber = 1; readLine(fh, line); ++lineNumber)
 	{
-		GBAInstrument const& gbaInst = bank.instruments[instIndex];
+		std::vector<std::string> tokens;
+		size_t pos = 0;
+		while ((pos = line.find_first_not_of(" \t\r", pos)) != std::string::npos)
+		{
+			size_t const end = std::min(line.find_first_of(" \t\r", pos), line.size());
+			tokens.push_back(line.substr(pos, end-pos));
+			pos = end;
+		}
+		if (tokens.empty() || tokens[0][0] == '#')
+			continue;
 
-		XMInstrument xmInst;
+		BatchEntry& entry = entries.emplace_back();
+		entry.path = tokens[0];
+		for (size_t tokenIndex = 1; tokenIndex < tokens.size(); ++tokenIndex)
 		{
-			xmInst.name = fmt::format("Instrument {:02x}", instIndex+1);
-			xmInst.type = 0;
-			if (gbaInst.sample.size() > 0)
+			int64_t bankAddress = 0;
+			if (!tryParseNumber(tokens[tokenIndex].c_str(), &bankAddress))
 			{
-				xmInst.extHeader.sampleHeaderSize = sizeof(xm_sample_header_t);
-				memset(xmInst.extHeader.sampleNumberForAllNotes, 0, sizeof(xmInst.extHeader.sampleNumberForAllNotes));
-				memcpy(xmInst.extHeader.volumeEnvelopePoints,  gbaInst.header.volumeEnvelope.points,  sizeof(xmInst.extHeader.volumeEnvelopePoints));
-				memcpy(xmInst.extHeader.panningEnvelopePoints, gbaInst.header.panningEnvelope.points, sizeof(xmInst.extHeader.panningEnvelopePoints));
-				xmInst.extHeader.volumePointCount  = gbaInst.header.volumeEnvelope.pointCount;
-				xmInst.extHeader.panningPointCount = gbaInst.header.panningEnvelope.pointCount;
-				// not certain about this:
-				//{
-					xmInst.extHeader.volumeSustainPoint    = gbaInst.header.volumeEnvelope.maybeSustainPoint;
-					xmInst.extHeader.volumeLoopStartPoint  = gbaInst.header.volumeEnvelope.maybeLoopStartPoint;
-					xmInst.extHeader.volumeLoopEndPoint    = gbaInst.header.volumeEnvelope.maybeLoopEndPoint;
-
-					xmInst.extHeader.panningSustainPoint   = gbaInst.header.panningEnvelope.maybeSustainPoint;
-					xmInst.extHeader.panningLoopStartPoint = gbaInst.header.panningEnvelope.maybeLoopStartPoint;
-					xmInst.extHeader.panningLoopEndPoint   = gbaInst.header.panningEnvelope.maybeLoopEndPoint;
-
-					xmInst.extHeader.volumeType = 0;
-					if (xmInst.extHeader.volumePointCount    != 0)    { xmInst.extHeader.volumeType  |= 0x01; /* on */ }
-					if (xmInst.extHeader.volumeSustainPoint  != 0xff) { xmInst.extHeader.volumeType  |= 0x02; /* sustain */ }
-					if (xmInst.extHeader.volumeLoopEndPoint  != 0xff) { xmInst.extHeader.volumeType  |= 0x04; /* loop */ }
-
-					xmInst.extHeader.panningType = 0;
-					if (xmInst.extHeader.panningPointCount   != 0)    { xmInst.extHeader.panningType |= 0x01; /* on */ }
-					if (xmInst.extHeader.panningSustainPoint != 0xff) { xmInst.extHeader.panningType |= 0x02; /* sustain */ }
-					if (xmInst.extHeader.panningLoopEndPoint != 0xff) { xmInst.extHeader.panningType |= 0x04; /* loop */ }
-				//}
-				xmInst.extHeader.vibratoType   = 0; // TODO: figure out what any of these do
-				xmInst.extHeader.vibratoSweep  = 0; // TODO: figure out what any of these do
-				xmInst.extHeader.vibratoDepth  = 0; // TODO: figure out what any of these do
-				xmInst.extHeader.vibratoRate   = 0; // TODO: figure out what any of these do
-				xmInst.extHeader.volumeFadeout = gbaInst.header.volumeFadeout;
-				xmInst.extHeader.reserved = 0;
-
-				XMSample xmSample;
-				{
-					xmSample.loopStart  = gbaInst.header.sampleLoopStart;
-					xmSample.loopLength = gbaInst.header.sampleLoopLength;
-					xmSample.volume     = gbaInst.header.sampleVolume;
-					xmSample.finetine   = gbaInst.header.sampleFinetune;
-
-					xmSample.typeFlags = 0;
-					if (gbaInst.header.sampleLoopLength > 0)
-					{
-						xmSample.typeFlags |= 0x01; // Forward loop
-					}
-
-					xmSample.panning = gbaInst.header.samplePanning;
-					xmSample.relativeNoteNumber = gbaInst.header.sampleRelativeNoteNumber;
-					xmSample.name = fmt::format("Sample {:02x}", instIndex+1);
-					xmSample.data = gbaInst.sample;
-
-					// delta-encoding data
-					for (int i = xmSample.data.size() - 1; i > 0; --i)
-					{
-						xmSample.data[i] -= xmSample.data[i-1];
-					}
-				}
-				xmInst.samples.push_back(xmSample);
+				fmt::print(stderr, "{}:{}: failed to parse '{}' as a number\n", manifestPath, lineNumber, tokens[tokenIndex]);
+				exit(1);
 			}
+			// in case the user used an 08xxxxxx address, mask off the top bits
+			entry.bankAddresses.push_back(size_t(bankAddress & 0x00ffffff));
 		}
-		xm.instruments.push_back(xmInst);
+		// 0x123456 and 0x08123456 are the same bank, and converting it twice would have two threads writing the same files
+		std::sort(entry.bankAddresses.begin(), entry.bankAddresses.end());
+		entry.bankAddresses.erase(std::unique(entry.bankAddresses.begin(), entry.bankAddresses.end()), entry.bankAddresses.end());
+	}
+	fclose(fh);
+	return entries;
+}
+
+// each rom's songs go in a directory named after the rom, minus its extension.
+// roms with the same name in different places get numbered directories rather than sharing one,
+// skipping numbers that would land on another rom's own name (a.gba, a.gb and a-2.gba get a, a-3 and a-2).
+std::vector<std::string> batchOutputDirs(std::vector<BatchEntry> const& entries)
+{
+	std::vector<std::string> stems;
+	for (BatchEntry const& entry : entries)
+	{
+		size_t const slash = entry.path.find_last_of("/\\");
+		std::string name = (slash == std::string::npos) ? entry.path : entry.path.substr(slash+1);
+		size_t const dot = name.find_last_of('.');
+		if (dot != std::string::npos && dot > 0)
+			name.resize(dot);
+		stems.push_back(std::move(name));
 	}
 
-	return xm;
+	std::set<std::string> const realNames(stems.begin(), stems.end());
+	std::set<std::string> taken;
+	std::map<std::string, int> nextNumber;
+	std::vector<std::string> dirs;
+	for (std::string const& stem : stems)
+	{
+		std::string name = stem;
+		if (!taken.insert(name).second)
+		{
+			int& number = nextNumber.try_emplace(stem, 2).first->second;
+			do
+			{
+				name = fmt::format("{}-{}", stem, number++);
+			} while (realNames.count(name) != 0 || !taken.insert(name).second);
+		}
+		dirs.push_back(std::move(name));
+	}
+	return dirs;
 }
 
-int main(int argc, char** argv)
+struct SongJob {
+	GBAMusicBank* bank;
+	size_t songIndex;
+};
+
+// where a run's songs go: separate files, or entries in one archive
+struct SongSink {
+	FILE* archive = nullptr;
+	int64_t archiveTime = 0;
+};
+
+// the song as a complete archive entry, header and padding included, so it can be written out in one go.
+// returns nothing if the name can't be stored in the archive.
+std::string songArchiveEntry(GBAMusicBank const& bank, GBASong const& song, std::string const& songName, std::string const& entryName, int64_t mtime)
+{
+	XMFile xm = convertSong(bank, song);
+	xm.moduleName = songName;
+
+	size_t const xmSize = xm.serializedSize();
+	std::string entry(kTarBlockSize + tarPaddedSize(xmSize), '\0');
+	uint8_t* const bytes = reinterpret_cast<uint8_t*>(entry.data());
+	if (!makeTarHeader(entryName, xmSize, mtime, bytes))
+		return std::string();
+	xm.serializeInto(bytes+kTarBlockSize);
+	return entry;
+}
+
+// converts the songs on up to threadCount threads, writing them into `dir` (or the top of the archive, if it's empty).
+// archive entries still go out in job order. `songLog`, if given, gets a line per song, also in order.
+// returns false if any song couldn't be written.
+bool exportSongs(std::vector<SongJob> const& jobs, std::string const& fourcc, std::string const& dir, SongSink const& sink, int threadCount, FILE* songLog)
 {
-	if (argc <= 2)
+	std::optional<OrderedOutput> log;
+	if (songLog)
+		log.emplace(jobs.size(), songLog);
+	std::optional<OrderedOutput> archive;
+	if (sink.archive)
+		archive.emplace(jobs.size(), sink.archive);
+
+	std::atomic<bool> failed(false);
+	parallelFor(jobs.size(), threadCount, [&](size_t jobIndex) {
+		SongJob const& job = jobs[jobIndex];
+		std::string const songName = songModuleName(fourcc, job.bank->address(), job.songIndex);
+		std::string const outfilePath = dir.empty() ? songName + ".xm" : fmt::format("{}/{}.xm", dir, songName);
+
+		TRACE_SCOPE_ARG("export song", "song", job.songIndex);
+
+		if (log)
+			log->submit(jobIndex, fmt::format("Saving song {:02x} to {}\n", job.songIndex, outfilePath));
+
+		if (archive)
+		{
+			std::string entry = songArchiveEntry(*job.bank, job.bank->song(job.songIndex), songName, outfilePath, sink.archiveTime);
+			if (entry.empty())
+			{
+				fmt::print(stderr, "{} is too long a name for the archive\n", outfilePath);
+				failed = true;
+			}
+			countAdd(Counter::BytesWritten, entry.size());
+			archive->submit(jobIndex, std::move(entry));
+			return;
+		}
+
+		FILE* fhOut = fopen(outfilePath.c_str(), "wb");
+		if (!fhOut)
+		{
+			fmt::print(stderr, "failed to open {} for writing\n", outfilePath);
+			failed = true;
+			return;
+		}
+		bool const written = writeSongXM(*job.bank, job.bank->song(job.songIndex), songName, fhOut) && !ferror(fhOut);
+		if ((fclose(fhOut) != 0) || !written)
+		{
+			fmt::print(stderr, "failed to write {}\n", outfilePath);
+			failed = true;
+		}
+	});
+	return !failed;
+}
+
+// runs on its own thread, staying a rom or two ahead of the conversion.
+// it scans on just this thread, as the conversion it overlaps with already has all of -j.
+void loadBatch(std::vector<BatchEntry> const& entries, BoundedQueue<LoadedRom>& loaded)
+{
+	for (size_t entryIndex = 0; entryIndex < entries.size(); ++entryIndex)
+	{
+		TRACE_SCOPE_ARG("load rom", "rom", entryIndex);
+
+		BatchEntry const& entry = entries[entryIndex];
+		LoadedRom rom;
+		rom.entryIndex = entryIndex;
+
+		rom.file = std::make_unique<MappedFile>(entry.path.c_str());
+		if (!rom.file->isOpen())
+		{
+			rom.errors.push_back(fmt::format("Failed to open {} for reading", entry.path));
+			loaded.push(std::move(rom));
+			continue;
+		}
+
+		ByteView const romView = rom.file->view();
+		rom.fourcc = cartFourcc(romView);
+
+		std::vector<size_t> bankAddresses = entry.bankAddresses;
+		if (bankAddresses.empty())
+		{
+			for (FoundBank const& found : scanForMusicBanks(romView, 0, romView.size))
+				bankAddresses.push_back(found.address);
+		}
+
+		for (size_t bankAddress : bankAddresses)
+		{
+			if (bankAddress >= romView.size)
+			{
+				rom.errors.push_back(fmt::format("There is no bank at {:06x}, {} is only {} bytes", bankAddress, entry.path, romView.size));
+				continue;
+			}
+			GBAMusicBank& bank = rom.banks.emplace_back(romView, bankAddress);
+			for (size_t songIndex = 0; songIndex < bank.songCount(); ++songIndex)
+				bank.song(songIndex);
+		}
+
+		loaded.push(std::move(rom));
+	}
+	loaded.close();
+}
+
+// exports every bank of every rom, reading and decoding the next rom while the current one is converted.
+// a rom that fails doesn't stop the rest; returns false if any did.
+bool exportBatch(std::vector<BatchEntry> const& entries, std::string const& outputRoot, SongSink const& sink, int threadCount, FILE* logFile)
+{
+	std::vector<std::string> const outputDirs = batchOutputDirs(entries);
+
+	// two roms in flight is enough to keep both sides busy, without mapping the whole library at once
+	BoundedQueue<LoadedRom> loaded(2);
+	std::thread loader(loadBatch, std::cref(entries), std::ref(loaded));
+
+	bool succeeded = true;
+	while (std::optional<LoadedRom> rom = loaded.pop())
 	{
-		fmt::print(stderr, "Expected two args! usage:\n");
-		fmt::print(stderr, "gba2xm romfile.gba <bank offset>\n");
+		TRACE_SCOPE_ARG("export rom", "rom", rom->entryIndex);
+
+		std::string const& romPath = entries[rom->entryIndex].path;
+		// in an archive, each rom's directory is at the top level rather than under the output root
+		std::string const outputDir = sink.archive ? outputDirs[rom->entryIndex] : fmt::format("{}/{}", outputRoot, outputDirs[rom->entryIndex]);
+
+		for (std::string const& error : rom->errors)
+		{
+			fmt::print(stderr, "{}\n", error);
+			succeeded = false;
+		}
+		if (rom->banks.empty())
+		{
+			if (rom->errors.empty())
+			{
+				fmt::print(logFile, "No music banks found in {}\n", romPath);
+				fflush(logFile);
+			}
+			continue;
+		}
+
+		std::error_code error;
+		if (!sink.archive)
+			std::filesystem::create_directories(outputDir, error);
+		if (error)
+		{
+			fmt::print(stderr, "Failed to create {}: {}\n", outputDir, error.message());
+			succeeded = false;
+			continue;
+		}
+
+		std::vector<SongJob> jobs;
+
+		fmt::print(logFile, "Exporting {} music banks from {} to {}\n", rom->banks.size(), romPath, outputDir);
+		for (GBAMusicBank& bank : rom->banks)
+		{
+			if (bank.truncated)
+			{
+				fmt::print(stderr, "Warning: music bank at {:06x} extends past the end of {}\n", bank.address(), romPath);
+			}
+			fmt::print(logFile, "\t{:06x}: {} songs, {} shared instruments\n", bank.address(), bank.songCount(), bank.instruments.size());
+			for (size_t songIndex = 0; songIndex < bank.songCount(); ++songIndex)
+				jobs.push_back({ &bank, songIndex });
+		}
+		fflush(logFile);
+
+		succeeded &= exportSongs(jobs, rom->fourcc, outputDir, sink, threadCount, nullptr);
+	}
+
+	loader.join();
+	return succeeded;
+}
+
+// ends the archive, if there is one. returns false if anything written to it failed.
+bool finishArchive(SongSink const& sink, char const* archivePath)
+{
+	if (!sink.archive)
+		return true;
+
+	uint8_t const end[kTarEndSize] = {};
+	countAdd(Counter::BytesWritten, fwrite(end, 1, sizeof(end), sink.archive));
+
+	bool ok = fflush(sink.archive) == 0 && !ferror(sink.archive);
+	if (sink.archive != stdout)
+		ok &= (fclose(sink.archive) == 0);
+	if (!ok)
+		fmt::print(stderr, "Failed to write the archive to {}\n", archivePath);
+	return ok;
+}
+
+void finishRun(bool printStats, char const* tracePath)
+{
+	if (printStats)
+	{
+		printCounters(stderr);
+	}
+
+	if (tracePath && !traceWrite(tracePath))
+	{
+		fmt::print(stderr, "Failed to write the trace to {}\n", tracePath);
 		exit(1);
 	}
+}
+
+int main(int argc, char** argv)
+{
+	int threadCount = 1;
+	std::vector<size_t> songIndices;
+	char const* saveSnapshotPath = nullptr;
+	char const* loadSnapshotPath = nullptr;
+	char const* tracePath = nullptr;
+	bool printStats = false;
+	char const* manifestPath = nullptr;
+	bool scanRoms = false;
+	char const* outputRoot = nullptr;
+	char const* archivePath = nullptr;
+	std::vector<char const*> positionalArgs;
+
+	for (int argIndex = 1; argIndex < argc; ++argIndex)
+	{
+		char const* arg = argv[argIndex];
+		if (strcmp(arg, "-j") == 0 && argIndex+1 < argc)
+		{
+			char const* threadCountStr = argv[++argIndex];
+			if (!tryParseThreadCount(threadCountStr, &threadCount))
+			{
+				fmt::print(stderr, "Failed to parse '{}' as a thread count\n", threadCountStr);
+				exit(1);
+			}
+		}
+		else if (strcmp(arg, "--song") == 0 && argIndex+1 < argc)
+		{
+			char const* songIndexStr = argv[++argIndex];
+			int64_t songIndex = 0;
+			if (!tryParseNumber(songIndexStr, &songIndex) || songIndex < 0)
+			{
+				fmt::print(stderr, "Failed to parse '{}' as a song index\n", songIndexStr);
+				exit(1);
+			}
+			songIndices.push_back(size_t(songIndex));
+		}
+		else if (strcmp(arg, "--save-snapshot") == 0 && argIndex+1 < argc)
+		{
+			saveSnapshotPath = argv[++argIndex];
+		}
+		else if (strcmp(arg, "--load-snapshot") == 0 && argIndex+1 < argc)
+		{
+			loadSnapshotPath = argv[++argIndex];
+		}
+		else if (strcmp(arg, "--manifest") == 0 && argIndex+1 < argc)
+		{
+			manifestPath = argv[++argIndex];
+		}
+		else if (strcmp(arg, "--scan") == 0)
+		{
+			scanRoms = true;
+		}
+		else if (strcmp(arg, "--out") == 0 && argIndex+1 < argc)
+		{
+			outputRoot = argv[++argIndex];
+		}
+		else if (strcmp(arg, "--archive") == 0 && argIndex+1 < argc)
+		{
+			archivePath = argv[++argIndex];
+		}
+		else if (strcmp(arg, "--stats") == 0)
+		{
+			printStats = true;
+		}
+		else if (strcmp(arg, "--trace") == 0 && argIndex+1 < argc)
+		{
+			tracePath = argv[++argIndex];
+		}
+		else
+		{
+			positionalArgs.push_back(arg);
+		}
+	}
 
-	char const* romPath = argv[1];
-	char const* bankAddressStr = argv[2];
+	// the same song asked for twice would have two threads writing the same file
+	std::sort(songIndices.begin(), songIndices.end());
+	songIndices.erase(std::unique(songIndices.begin(), songIndices.end()), songIndices.end());
 
-	FILE* fhIn = fopen(romPath, "rb");
-	if (!fhIn)
+	bool const batchMode = manifestPath || scanRoms;
+	bool const validArgs = batchMode
+		? (manifestPath ? positionalArgs.empty() : !positionalArgs.empty()) && !(manifestPath && scanRoms)
+		: (loadSnapshotPath ? positionalArgs.empty() : positionalArgs.size() == 2);
+	if (!validArgs)
 	{
-		fmt::print(stderr, "Failed to open {} for reading\n", romPath);
+		fmt::print(stderr, "Expected two args, a snapshot, or a batch! usage:\n");
+		fmt::print(stderr, "gba2xm [-j threads] [--song N]... [--save-snapshot file] [--archive out.tar] [--stats] [--trace out.json] romfile.gba <bank offset>\n");
+		fmt::print(stderr, "gba2xm [-j threads] [--song N]... [--archive out.tar] [--stats] [--trace out.json] --load-snapshot file\n");
+		fmt::print(stderr, "gba2xm [-j threads] [--out dir | --archive out.tar] [--stats] [--trace out.json] --manifest file\n");
+		fmt::print(stderr, "gba2xm [-j threads] [--out dir | --archive out.tar] [--stats] [--trace out.json] --scan romfile.gba [romfile2.gba, ...]\n");
 		exit(1);
 	}
 
-	int64_t bankAddress = 0;
-	if (!tryParseNumber(bankAddressStr, &bankAddress))
+	if (batchMode && (!songIndices.empty() || saveSnapshotPath || loadSnapshotPath))
 	{
-		fmt::print(stderr, "Failed to parse '{}' as a number\n", bankAddressStr);
+		fmt::print(stderr, "--song and snapshots can't be used with --manifest or --scan\n");
 		exit(1);
 	}
-	// in case the user used an 08xxxxxx address, mask off the top bits
-	bankAddress &= 0x00ffffff;
 
-	GBAMusicBank gbaMusicBank(fhIn, bankAddress);
-	fmt::print(
-		"Loaded a music bank with {} songs and {} shared instruments\n",
-		gbaMusicBank.songs.size(),
-		gbaMusicBank.instruments.size());
+	if (!batchMode && outputRoot)
+	{
+		fmt::print(stderr, "--out only applies to --manifest or --scan\n");
+		exit(1);
+	}
 
-	// get the fourcc from the cart header
-	char fourcc[5] = { 0 };
-	fseek(fhIn, 0xAC, SEEK_SET);
-	fread(fourcc, 1, 4, fhIn);
+	if (archivePath && outputRoot)
+	{
+		fmt::print(stderr, "--out and --archive can't be used together\n");
+		exit(1);
+	}
 
-	fclose(fhIn);
+	if (tracePath && !traceStart())
+	{
+		fmt::print(stderr, "--trace isn't available, this build has tracing compiled out\n");
+		exit(1);
+	}
 
-	std::string const trackerName = fmt::format("esgba2xm-{}.{}.{}", kToolVersionMajor, kToolVersionMinor, kToolVersionPatch);
+	// the archive is written strictly front to back, so it can just as well go down a pipe.
+	// the log moves out of its way if so.
+	SongSink sink;
+	bool const archiveToStdout = archivePath && strcmp(archivePath, "-") == 0;
+	FILE* const logFile = archiveToStdout ? stderr : stdout;
+	if (archivePath)
+	{
+		if (archiveToStdout)
+		{
+#if defined(_WIN32)
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			sink.archive = stdout;
+		}
+		else
+		{
+			sink.archive = fopen(archivePath, "wb");
+			if (!sink.archive)
+			{
+				fmt::print(stderr, "Failed to open {} for writing\n", archivePath);
+				exit(1);
+			}
+		}
+		setvbuf(sink.archive, nullptr, _IOFBF, 1024*1024);
+		sink.archiveTime = int64_t(time(nullptr));
+	}
 
-	for (uint32_t songIndex = 0; songIndex < gbaMusicBank.songs.size(); ++songIndex)
+	if (batchMode)
 	{
-		std::string const songName = fmt::format("{}-{:06X}-song{:02X}", fourcc, bankAddress, songIndex);
-		std::string const outfilePath = songName + ".xm";
+		std::vector<BatchEntry> entries;
+		if (manifestPath)
+		{
+			entries = readManifest(manifestPath);
+		}
+		else
+		{
+			for (char const* romPath : positionalArgs)
+				entries.push_back({ romPath, {} });
+		}
 
-		GBASong const& song = gbaMusicBank.songs[songIndex];
-		XMFile xm = convert(gbaMusicBank, song);
+		bool succeeded = exportBatch(entries, outputRoot ? outputRoot : ".", sink, threadCount, logFile);
+		succeeded &= finishArchive(sink, archivePath);
+		finishRun(printStats, tracePath);
+		return succeeded ? 0 : 1;
+	}
 
-		xm.moduleName = songName;
-		xm.trackerName = trackerName;
+	OpenedBank opened = loadSnapshotPath
+		? openBankFromSnapshot(loadSnapshotPath)
+		: openBankFromRom(positionalArgs[0], positionalArgs[1]);
+	GBAMusicBank& gbaMusicBank = *opened.bank;
+	size_t const bankAddress = gbaMusicBank.address();
 
-		// strip unused samples
-		bool usedInstruments[256] = {0};
-		for (auto const& pattern : xm.patterns)
-			for (auto const& row : pattern.rows)
-				for (auto const& cell : row.cells)
-					if (cell.inst)
-						usedInstruments[cell.inst-1] = true;
-		for (uint32_t i = 0; i < xm.instruments.size(); ++i)
-			if (!usedInstruments[i])
-				xm.instruments[i].samples.clear();
+	if (saveSnapshotPath)
+	{
+		saveBankSnapshot(opened, saveSnapshotPath);
+	}
 
-		fmt::print("Saving song {:02x} to {}\n", songIndex, outfilePath);
+	if (songIndices.empty())
+	{
+		for (size_t songIndex = 0; songIndex < gbaMusicBank.songCount(); ++songIndex)
+		{
+			songIndices.push_back(songIndex);
+		}
+	}
 
-		FILE* fhOut = fopen(outfilePath.c_str(), "wb");
-		if (!fhOut)
+	// songs are decoded on first use, so only the selected ones get decoded at all
+	for (size_t songIndex : songIndices)
+	{
+		if (songIndex >= gbaMusicBank.songCount())
 		{
-			fmt::print(stderr, "failed to open {} for writing\n", outfilePath);
+			fmt::print(stderr, "There is no song {:02x}, the bank only has {} songs\n", songIndex, gbaMusicBank.songCount());
 			exit(1);
 		}
-		xm.save(fhOut);
-		fclose(fhOut);
+		gbaMusicBank.song(songIndex);
+	}
+
+	if (gbaMusicBank.truncated)
+	{
+		fmt::print(stderr, "Warning: music bank at {:06x} extends past the end of {}\n", bankAddress, opened.path);
 	}
+	fmt::print(logFile,
+		"Loaded a music bank with {} songs and {} shared instruments\n",
+		gbaMusicBank.songCount(),
+		gbaMusicBank.instruments.size());
+	fmt::print(logFile,
+		"Decoded {} unique rows for {} row references\n",
+		gbaMusicBank.uniqueRowCount,
+		gbaMusicBank.referencedRowCount);
+
+	// the bank is only read from here on, so songs can be converted and saved independently
+	std::vector<SongJob> jobs;
+	for (size_t songIndex : songIndices)
+	{
+		jobs.push_back({ &gbaMusicBank, songIndex });
+	}
+	bool succeeded = exportSongs(jobs, opened.fourcc, std::string(), sink, threadCount, logFile);
+	succeeded &= finishArchive(sink, archivePath);
+
+	finishRun(printStats, tracePath);
+	return succeeded ? 0 : 1;
 }
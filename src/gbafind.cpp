@@ -1,130 +1,227 @@
+#include <algorithm>
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <fmt/core.h>
-#include "common-gba.h"
+#include "bank-scan.h"
+#include "content-hash.h"
+#include "mapped-file.h"
 #include "misc.h"
+#include "scan-index.h"
+#include "thread-pool.h"
+#include "trace.h"
 
-int main(int argc, char const* const* argv)
+std::string formatScanStats(char const* filepath, BankScanStats const& stats)
 {
-	if (argc <= 1)
+	std::string text = fmt::format("{}: {} positions scanned\n", filepath, stats.positions);
+	for (int stage = 0; stage < kBankScanStageCount-1; ++stage)
 	{
-		fmt::print(stderr, "Expected at least one arg! usage:\n");
-		fmt::print(stderr, "gbafind romfile.gba [romfile2.gba, ...]\n");
-		exit(1);
+		uint64_t const reached = stats.reached[stage];
+		uint64_t const rejected = reached - stats.reached[stage+1];
+		text += fmt::format("\t{:<24} {:>10} in, {:>10} rejected ({:.4f}%)\n",
+			bankScanStageName(BankScanStage(stage)),
+			reached,
+			rejected,
+			reached ? (100.0*rejected/reached) : 0.0);
 	}
+	text += fmt::format("\t{:<24} {:>10}\n", "accepted", stats.reached[int(BankScanStage::Accepted)]);
+	return text;
+}
 
-	int const kMaxSongLength = 0xff;
-	int const kMaxSongCount = 0xff;
+int main(int argc, char const* const* argv)
+{
+	bool verbose = false;
+	int threadCount = 1;
+	char const* indexPath = nullptr;
+	bool rebuildIndex = false;
+	char const* tracePath = nullptr;
+	bool printStats = false;
+	std::vector<char const*> filepaths;
 
-	FILE* fh = nullptr;
 	for (int argIndex = 1; argIndex < argc; ++argIndex)
 	{
-		if (fh)
+		char const* arg = argv[argIndex];
+		if (strcmp(arg, "-v") == 0)
+		{
+			verbose = true;
+		}
+		else if (strcmp(arg, "-j") == 0 && argIndex+1 < argc)
+		{
+			char const* threadCountStr = argv[++argIndex];
+			if (!tryParseThreadCount(threadCountStr, &threadCount))
+			{
+				fmt::print(stderr, "Failed to parse '{}' as a thread count\n", threadCountStr);
+				exit(1);
+			}
+		}
+		else if (strcmp(arg, "--index") == 0 && argIndex+1 < argc)
+		{
+			indexPath = argv[++argIndex];
+		}
+		else if (strcmp(arg, "--rebuild") == 0)
+		{
+			rebuildIndex = true;
+		}
+		else if (strcmp(arg, "--stats") == 0)
 		{
-			fclose(fh);
-			fh = nullptr;
+			printStats = true;
 		}
+		else if (strcmp(arg, "--trace") == 0 && argIndex+1 < argc)
+		{
+			tracePath = argv[++argIndex];
+		}
+		else
+		{
+			filepaths.push_back(arg);
+		}
+	}
+
+	if (filepaths.empty())
+	{
+		fmt::print(stderr, "Expected at least one arg! usage:\n");
+		fmt::print(stderr, "gbafind [-v] [-j threads] [--index file [--rebuild]] [--stats] [--trace out.json] romfile.gba [romfile2.gba, ...]\n");
+		exit(1);
+	}
+
+	if (rebuildIndex && !indexPath)
+	{
+		fmt::print(stderr, "--rebuild needs an --index to rebuild\n");
+		exit(1);
+	}
+
+	if (tracePath && !traceStart())
+	{
+		fmt::print(stderr, "--trace isn't available, this build has tracing compiled out\n");
+		exit(1);
+	}
+
+	// a rebuild starts from nothing, so every rom gets scanned again.
+	// don't go overwriting something that was never an index, though.
+	ScanIndex index;
+	FileStamp existingIndex;
+	if (indexPath && tryStatFile(indexPath, &existingIndex) && !index.load(indexPath))
+	{
+		fmt::print(stderr, "{} exists but isn't a gbafind index\n", indexPath);
+		exit(1);
+	}
+	if (rebuildIndex)
+	{
+		index = ScanIndex();
+	}
+	std::vector<ScanIndex> indexUpdates(filepaths.size());
+
+	// spend spare threads inside each rom when there are fewer roms than threads
+	int const threadsPerFile = std::max<int>(1, threadCount / filepaths.size());
+	int const fileThreadCount = std::max(1, threadCount / threadsPerFile);
 
-		char const* filepath = argv[argIndex];
-		bool didPrintName = false;
+	OrderedOutput results(filepaths.size(), stdout);
+	OrderedOutput scanStats(filepaths.size(), stderr);
 
-		fh = fopen(filepath, "rb");
-		if (!fh)
-			continue;
+	parallelFor(filepaths.size(), fileThreadCount, [&](size_t fileIndex) {
+		char const* filepath = filepaths[fileIndex];
+		TRACE_SCOPE_ARG("scan rom", "file", fileIndex);
 
-		fseek(fh, 0, SEEK_END);
-		size_t const fileLength = ftell(fh);
-		fseek(fh, 0, SEEK_SET);
+		std::string text;
+		std::string statsText;
 
-		for (uint32_t baseAddr = 0; baseAddr < fileLength; baseAddr += 4)
+		std::vector<FoundBank> banks;
+		bool scanned = false;
+
+		FileStamp stamp;
+		bool const hasStamp = indexPath && tryStatFile(filepath, &stamp);
+		uint64_t hash = 0;
+		if (hasStamp && index.tryFindUnchanged(filepath, stamp, &hash))
 		{
-			fseek(fh, baseAddr, SEEK_SET);
-
-			gba_musicbank_header_t header;
-			fread(&header, sizeof(gba_musicbank_header_t), 1, fh);
-			if (header.version != 0x0121)
-				continue;
-			if (header.instrumentCount == 0)
-				continue;
-			if (header.songCount == 0)
-				continue;
-
-			uint32_t songOffsets[kMaxSongCount];
-			int const songOffsetsRead = fread(songOffsets, sizeof(uint32_t), header.songCount, fh);
-			if (songOffsetsRead != header.songCount)
-				continue;
-
-			bool instsValid = true;
-			for (int inst = 0; instsValid && inst < header.instrumentCount; ++inst)
-			{
-				gba_instrument_header_t instHeader;
-				int const instHeaderRead = fread(&instHeader, sizeof(instHeader), 1, fh);
-				instsValid &= (instHeaderRead == 1);
-				instsValid &= (instHeader.volumeEnvelope.pointCount <= 12);
-				instsValid &= (instHeader.panningEnvelope.pointCount <= 12);
-
-				int const seekResult = fseek(fh, instHeader.sampleLength, SEEK_CUR);
-				instsValid &= (seekResult == 0);
-				falign(fh, 4);
-			}
-			if (!instsValid)
-				continue;
-
-			// instruments shouldn't overshoot and overlap the songs
-			if (ftell(fh)-baseAddr > songOffsets[0])
-				continue;
-
-			// song offsets should be sorted
-			bool songOffsetsAreMonotonic = true;
-			for (int i = 1; i < header.songCount; ++i)
-				songOffsetsAreMonotonic &= (songOffsets[i-1] < songOffsets[i]);
-			if (!songOffsetsAreMonotonic)
-				continue;
-
-			bool songsValid = true;
-			for (int song = 0; songsValid && song < header.songCount; ++song)
+			banks = index.scans.at(hash);
+			scanned = true;
+			if (verbose)
+				statsText = fmt::format("{}: unchanged since it was indexed\n", filepath);
+		}
+		else
+		{
+			MappedFile file(filepath);
+			if (file.isOpen())
 			{
-				// songs should be 4byte aligned
-				songsValid &= (songOffsets[song] == (songOffsets[song] & 0xfffffffcu));
-				songsValid &= (songOffsets[song] < fileLength);
-
-				int const seekResult = fseek(fh, baseAddr+songOffsets[song], SEEK_SET);
-				songsValid &= (seekResult == 0);
-
-				gba_song_header_t songHeader;
-				int const songHeaderRead = fread(&songHeader, sizeof(songHeader), 1, fh);
-				songsValid &= (songHeaderRead == 1);
-				songsValid &= (songHeader.channelCount != 0);
-				songsValid &= (songHeader.songLength != 0);
-				songsValid &= (songHeader.patternCount != 0);
-				songsValid &= (songHeader.tickrate != 0);
-				songsValid &= (songHeader.tempo != 0);
-
-				falign(fh, 4);
-				uint8_t patternOrder[kMaxSongLength];
-				int const patternOrderRead = fread(patternOrder, 1, songHeader.songLength, fh);
-				songsValid &= (patternOrderRead == songHeader.songLength);
-
-				for (int i = 0; i < songHeader.songLength; ++i)
-					songsValid &= (patternOrder[i] < songHeader.patternCount);
+				file.advise(MappedFile::Access::Sequential);
+
+				ByteView const rom = file.view();
+
+				// the same rom may already be indexed under another name
+				auto known = index.scans.end();
+				if (hasStamp)
+				{
+					TRACE_SCOPE("hash rom");
+					hash = contentHash(rom);
+					countAdd(Counter::BytesTouched, rom.size);
+					known = index.scans.find(hash);
+				}
+				if (known != index.scans.end())
+				{
+					banks = known->second;
+					if (verbose)
+						statsText = fmt::format("{}: changed on disk, but its contents were already indexed\n", filepath);
+				}
+				else
+				{
+					BankScanStats stats;
+					banks = scanForMusicBanksParallel(rom, threadsPerFile, &stats);
+					if (verbose)
+						statsText = formatScanStats(filepath, stats);
+				}
+				scanned = true;
+
+				if (hasStamp)
+				{
+					indexUpdates[fileIndex].scans[hash] = banks;
+					indexUpdates[fileIndex].files[filepath] = { stamp, hash };
+				}
 			}
-			if (!songsValid)
-				continue;
+		}
 
-			if (!didPrintName)
-				fmt::print("\n{}\n", filepath);
-			didPrintName = true;
+		if (scanned && !banks.empty())
+			text += fmt::format("\n{}\n", filepath);
 
-			fmt::print(
+		for (FoundBank const& bank : banks)
+		{
+			text += fmt::format(
 				"@ {:06x}: v{:04x} {} instruments, {} songs\n",
-				baseAddr,
-				header.version,
-				header.instrumentCount,
-				header.songCount
+				bank.address,
+				bank.header.version,
+				bank.header.instrumentCount,
+				bank.header.songCount
 			);
 		}
 
-		fclose(fh);
+		results.submit(fileIndex, std::move(text));
+		scanStats.submit(fileIndex, std::move(statsText));
+	});
+
+	if (indexPath)
+	{
+		TRACE_SCOPE("update index");
+
+		ScanIndex updates;
+		for (ScanIndex const& update : indexUpdates)
+		{
+			updates.merge(update);
+		}
+		bool const changed = rebuildIndex || !updates.files.empty();
+		if (changed && !ScanIndex::update(indexPath, updates, rebuildIndex))
+		{
+			fmt::print(stderr, "Failed to update the index at {}\n", indexPath);
+			exit(1);
+		}
+	}
+
+	if (printStats)
+	{
+		printCounters(stderr);
+	}
+
+	if (tracePath && !traceWrite(tracePath))
+	{
+		fmt::print(stderr, "Failed to write the trace to {}\n", tracePath);
+		exit(1);
 	}
 }
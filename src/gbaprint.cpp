@@ -1,146 +1,143 @@
 #include <cstdio>
+#include <cstring>
+#include <vector>
 #include <fmt/core.h>
+#include "bank-print.h"
+#include "bank-source.h"
 #include "common-gba.h"
+#include "mapped-file.h"
 #include "misc.h"
+#include "trace.h"
 
 int main(int argc, char** argv)
 {
-	if (argc <= 2)
+	std::vector<size_t> songIndices;
+	char const* saveSnapshotPath = nullptr;
+	char const* loadSnapshotPath = nullptr;
+	char const* tracePath = nullptr;
+	bool printStats = false;
+	bool instrumentsOnly = false;
+	std::vector<char const*> positionalArgs;
+
+	for (int argIndex = 1; argIndex < argc; ++argIndex)
 	{
-		fmt::print(stderr, "Expected two args! usage:\n");
-		fmt::print(stderr, "gbaprint romfile.gba <bank offset>\n");
-		exit(1);
+		char const* arg = argv[argIndex];
+		if (strcmp(arg, "--song") == 0 && argIndex+1 < argc)
+		{
+			char const* songIndexStr = argv[++argIndex];
+			int64_t songIndex = 0;
+			if (!tryParseNumber(songIndexStr, &songIndex) || songIndex < 0)
+			{
+				fmt::print(stderr, "Failed to parse '{}' as a song index\n", songIndexStr);
+				exit(1);
+			}
+			songIndices.push_back(size_t(songIndex));
+		}
+		else if (strcmp(arg, "--instruments-only") == 0)
+		{
+			instrumentsOnly = true;
+		}
+		else if (strcmp(arg, "--save-snapshot") == 0 && argIndex+1 < argc)
+		{
+			saveSnapshotPath = argv[++argIndex];
+		}
+		else if (strcmp(arg, "--load-snapshot") == 0 && argIndex+1 < argc)
+		{
+			loadSnapshotPath = argv[++argIndex];
+		}
+		else if (strcmp(arg, "--stats") == 0)
+		{
+			printStats = true;
+		}
+		else if (strcmp(arg, "--trace") == 0 && argIndex+1 < argc)
+		{
+			tracePath = argv[++argIndex];
+		}
+		else
+		{
+			positionalArgs.push_back(arg);
+		}
 	}
 
-	char const* romPath = argv[1];
-	char const* bankAddressStr = argv[2];
+	if (loadSnapshotPath ? !positionalArgs.empty() : positionalArgs.size() != 2)
+	{
+		fmt::print(stderr, "Expected two args, or a snapshot! usage:\n");
+		fmt::print(stderr, "gbaprint [--song N]... [--instruments-only] [--save-snapshot file] [--stats] [--trace out.json] romfile.gba <bank offset>\n");
+		fmt::print(stderr, "gbaprint [--song N]... [--instruments-only] [--stats] [--trace out.json] --load-snapshot file\n");
+		exit(1);
+	}
 
-	FILE* fhIn = fopen(romPath, "rb");
-	if (!fhIn)
+	if (instrumentsOnly && !songIndices.empty())
 	{
-		fmt::print(stderr, "Failed to open {} for reading\n", romPath);
+		fmt::print(stderr, "--song and --instruments-only can't be used together\n");
 		exit(1);
 	}
 
-	int64_t bankAddress = 0;
-	if (!tryParseNumber(bankAddressStr, &bankAddress))
+	if (tracePath && !traceStart())
 	{
-		fmt::print(stderr, "Failed to parse '{}' as a number\n", bankAddressStr);
+		fmt::print(stderr, "--trace isn't available, this build has tracing compiled out\n");
 		exit(1);
 	}
-	// in case the user used an 08xxxxxx address, mask off the top bits
-	bankAddress &= 0x00ffffff;
 
-	GBAMusicBank gbaMusicBank(fhIn, bankAddress);
+	OpenedBank opened = loadSnapshotPath
+		? openBankFromSnapshot(loadSnapshotPath)
+		: openBankFromRom(positionalArgs[0], positionalArgs[1]);
+	GBAMusicBank& gbaMusicBank = *opened.bank;
+	size_t const bankAddress = gbaMusicBank.address();
 
-	for (uint32_t instrIndex = 0; instrIndex < gbaMusicBank.instruments.size(); ++instrIndex)
+	if (saveSnapshotPath)
 	{
-		GBAInstrument const& instrument = gbaMusicBank.instruments[instrIndex];
+		saveBankSnapshot(opened, saveSnapshotPath);
+	}
 
-		fmt::print("------ instrument {:02x} ------\n", instrIndex+1);
-		fmt::print("\tsample length: {} bytes\n", instrument.header.sampleLength);
-		fmt::print("\tsample loop start:  {}\n", instrument.header.sampleLoopStart);
-		fmt::print("\tsample loop length: {}\n", instrument.header.sampleLoopLength);
-		fmt::print("\tsample volume:      {}\n", instrument.header.sampleVolume);
-		fmt::print("\tsample panning:     {}\n", instrument.header.samplePanning);
-		fmt::print("\tsample finetune:    {}\n", instrument.header.sampleFinetune);
-		fmt::print("\tsample relative note #: {}\n", instrument.header.sampleRelativeNoteNumber);
-		fmt::print("\tvolume fadeout:     {}\n", instrument.header.volumeFadeout);
-		fmt::print("\tunknown bytes:      {:02x} {:02x}\n", instrument.header.unknownBytes[0], instrument.header.unknownBytes[1]);
+	// picking out songs skips the instruments, and picking out the instruments skips the songs
+	bool const printInstruments = songIndices.empty();
+	if (songIndices.empty() && !instrumentsOnly)
+	{
+		for (size_t songIndex = 0; songIndex < gbaMusicBank.songCount(); ++songIndex)
 		{
-			fmt::print("\t-- volume envelope --\n");
-			fmt::print("\t\tpoint count:      {}\n", instrument.header.volumeEnvelope.pointCount);
-			fmt::print("\t\tsustain point?    {}\n", instrument.header.volumeEnvelope.maybeSustainPoint);
-			fmt::print("\t\tloop start point? {}\n", instrument.header.volumeEnvelope.maybeLoopStartPoint);
-			fmt::print("\t\tloop end point?   {}\n", instrument.header.volumeEnvelope.maybeLoopEndPoint);
-			if (instrument.header.volumeEnvelope.pointCount != 0)
-			{
-				fmt::print("\t\tpoints:");
-				for (int j = 0; j < instrument.header.volumeEnvelope.pointCount; ++j)
-				{
-					fmt::print(" [{}, {}],",
-						instrument.header.volumeEnvelope.points[j].x,
-						instrument.header.volumeEnvelope.points[j].y);
-				}
-				fmt::print("\n");
-			}
+			songIndices.push_back(songIndex);
 		}
+	}
+
+	// songs are decoded on first use, so only the selected ones get decoded at all
+	for (size_t songIndex : songIndices)
+	{
+		if (songIndex >= gbaMusicBank.songCount())
 		{
-			fmt::print("\t-- panning envelope --\n");
-			fmt::print("\t\tpoint count:      {}\n", instrument.header.panningEnvelope.pointCount);
-			fmt::print("\t\tsustain point?    {}\n", instrument.header.panningEnvelope.maybeSustainPoint);
-			fmt::print("\t\tloop start point? {}\n", instrument.header.panningEnvelope.maybeLoopStartPoint);
-			fmt::print("\t\tloop end point?   {}\n", instrument.header.panningEnvelope.maybeLoopEndPoint);
-			if (instrument.header.panningEnvelope.pointCount != 0)
-			{
-				fmt::print("\t\tpoints:");
-				for (int j = 0; j < instrument.header.panningEnvelope.pointCount; ++j)
-				{
-					fmt::print(" [{}, {}],",
-						instrument.header.panningEnvelope.points[j].x,
-						instrument.header.panningEnvelope.points[j].y);
-				}
-				fmt::print("\n");
-			}
+			fmt::print(stderr, "There is no song {:02x}, the bank only has {} songs\n", songIndex, gbaMusicBank.songCount());
+			exit(1);
 		}
-		fmt::print("\n");
+		gbaMusicBank.song(songIndex);
 	}
 
-	for (uint32_t songIndex = 0; songIndex < gbaMusicBank.songs.size(); ++songIndex)
+	if (gbaMusicBank.truncated)
 	{
-		fmt::print("------ song {:02x} ------\n", songIndex);
-
-		GBASong const& song = gbaMusicBank.songs[songIndex];
-
-		fmt::print("\tchannel count: {}\n", song.header.channelCount);
-		fmt::print("\tsong length:   {}\n", song.header.songLength);
-		fmt::print("\tloop point:    {}\n", song.header.loopPoint);
-		fmt::print("\tpattern count: {}\n", song.header.patternCount);
-		fmt::print("\ttickrate:      {} ticks/row\n", song.header.tickrate);
-		fmt::print("\ttempo:         {} beats/min\n", song.header.tempo);
+		fmt::print(stderr, "Warning: music bank at {:06x} extends past the end of {}\n", bankAddress, opened.path);
+	}
 
-		fmt::print("\tpattern order: [");
-		for (uint8_t patternInstance : song.patternOrder)
+	if (printInstruments)
+	{
+		for (uint32_t instrIndex = 0; instrIndex < gbaMusicBank.instruments.size(); ++instrIndex)
 		{
-			fmt::print(" {:02x}", patternInstance);
+			printInstrument(stdout, gbaMusicBank.instruments[instrIndex], instrIndex);
 		}
-		fmt::print(" ]\n");
-
-		for (int patternIndex = 0; patternIndex < song.header.patternCount; ++patternIndex)
-		{
-			fmt::print("\t-- pattern {:02x} --\n", patternIndex);
-
-			SharedPattern const& pattern = song.patterns[patternIndex];
-
-			for (uint32_t rowIndex = 0; rowIndex < pattern.rows.size(); ++rowIndex)
-			{
-				fmt::print("\t\t{:02x} |", rowIndex);
-
-				SharedRow const& row = pattern.rows[rowIndex];
+	}
 
-				char const* notes[] = {
-					"C-", "C#", "D-",
-					"D#", "E-", "F-",
-					"F#", "G-", "G#",
-					"A-", "A#", "B-",
-				};
+	for (size_t songIndex : songIndices)
+	{
+		printSong(stdout, gbaMusicBank.song(songIndex), songIndex);
+	}
 
-				for (int i = 0; i < song.header.channelCount; ++i)
-				{
-					SharedCell const& cell = row.cells[i];
-					uint8_t const note = (cell.note-1);
-					fmt::print(cell.note ? " {}{}" : " ---", notes[note%12], note/12);
-					fmt::print(cell.inst   ? " {:02x}" : " --", cell.inst);
-					fmt::print(cell.vol    ? " {:02x}" : " --", cell.vol);
-					fmt::print(cell.effect ? " {:02x}" : " --", cell.effect);
-					fmt::print(cell.param  ? " {:02x}" : " --", cell.param);
-					fmt::print(" |");
-				}
+	if (printStats)
+	{
+		printCounters(stderr);
+	}
 
-				fmt::print("\n");
-			}
-		}
-		fmt::print("\n");
+	if (tracePath && !traceWrite(tracePath))
+	{
+		fmt::print(stderr, "Failed to write the trace to {}\n", tracePath);
+		exit(1);
 	}
 
 	return 0;
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// a map that holds at most `capacity` entries, dropping whichever was used longest ago to make room.
+// not thread-safe; callers share one behind a lock.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+struct LruCache {
+	explicit LruCache(size_t capacity) : capacity(capacity) {}
+
+	// returns nullptr if the key isn't cached. a hit counts as a use.
+	Value* find(Key const& key)
+	{
+		auto found = index.find(key);
+		if (found == index.end())
+			return nullptr;
+
+		entries.splice(entries.begin(), entries, found->second);
+		return &found->second->second;
+	}
+
+	// adds or replaces the entry, as the most recently used
+	void insert(Key const& key, Value value)
+	{
+		auto found = index.find(key);
+		if (found != index.end())
+		{
+			found->second->second = std::move(value);
+			entries.splice(entries.begin(), entries, found->second);
+			return;
+		}
+
+		entries.emplace_front(key, std::move(value));
+		index.emplace(key, entries.begin());
+
+		while (entries.size() > capacity)
+		{
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+
+	size_t size() const { return entries.size(); }
+
+private:
+	size_t capacity;
+	std::list<std::pair<Key, Value>> entries; // most recently used first
+	std::unordered_map<Key, typename std::list<std::pair<Key, Value>>::iterator, Hash> index;
+};
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include "mapped-file.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(char const* path)
+{
+#if !defined(_WIN32)
+	int const fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+	{
+		this->opened = true;
+		this->size = st.st_size;
+		if (this->size > 0)
+		{
+			void* const ptr = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED)
+			{
+				this->data = static_cast<uint8_t const*>(ptr);
+				this->mapped = true;
+			}
+		}
+	}
+	close(fd);
+
+	if (this->mapped || (this->opened && this->size == 0))
+		return;
+#endif
+
+	// couldn't map it, so just read the whole thing instead
+	FILE* fh = fopen(path, "rb");
+	if (!fh)
+		return;
+
+	this->opened = true;
+	this->size = 0;
+	uint8_t chunk[65536];
+	size_t bytesRead;
+	while ((bytesRead = fread(chunk, 1, sizeof(chunk), fh)) > 0)
+	{
+		this->buffer.insert(this->buffer.end(), chunk, chunk+bytesRead);
+	}
+	fclose(fh);
+
+	this->data = this->buffer.data();
+	this->size = this->buffer.size();
+}
+
+MappedFile::~MappedFile()
+{
+#if !defined(_WIN32)
+	if (this->mapped)
+	{
+		munmap(const_cast<uint8_t*>(this->data), this->size);
+	}
+#endif
+}
+
+void MappedFile::advise(Access access, size_t offset, size_t length) const
+{
+#if !defined(_WIN32) && defined(MADV_NORMAL)
+	if (!this->mapped || offset >= this->size)
+		return;
+
+	if (length > this->size-offset)
+		length = this->size-offset;
+
+	// madvise wants a page-aligned start address
+	size_t const pageSize = sysconf(_SC_PAGESIZE);
+	size_t const alignedOffset = offset - (offset % pageSize);
+	length += offset-alignedOffset;
+
+	int advice = MADV_NORMAL;
+	switch (access)
+	{
+		case Access::Normal:     advice = MADV_NORMAL;     break;
+		case Access::Sequential: advice = MADV_SEQUENTIAL; break;
+		case Access::Random:     advice = MADV_RANDOM;     break;
+		case Access::WillNeed:   advice = MADV_WILLNEED;   break;
+	}
+	madvise(const_cast<uint8_t*>(this->data)+alignedOffset, length, advice);
+#else
+	(void)access;
+	(void)offset;
+	(void)length;
+#endif
+}
+
+bool tryStatFile(char const* path, FileStamp* stamp)
+{
+#if !defined(_WIN32)
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+
+#if defined(__APPLE__)
+	struct timespec const mtime = st.st_mtimespec;
+#else
+	struct timespec const mtime = st.st_mtim;
+#endif
+	stamp->size = st.st_size;
+	stamp->mtimeNanoseconds = int64_t(mtime.tv_sec)*1000000000 + mtime.tv_nsec;
+	return true;
+#else
+	(void)path;
+	(void)stamp;
+	return false;
+#endif
+}
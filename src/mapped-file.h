@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+// a non-owning view of some bytes, typically a whole rom
+struct ByteView {
+	uint8_t const* data = nullptr;
+	size_t size = 0;
+
+	ByteView() = default;
+	ByteView(uint8_t const* data, size_t size) : data(data), size(size) {}
+
+	bool contains(size_t offset, size_t count) const
+	{
+		return offset <= size && count <= size-offset;
+	}
+};
+
+
+// bounds-checked cursor over a ByteView.
+// reading past the end yields zeroes and sets `overrun`, rather than touching memory outside the view.
+struct ByteReader {
+	ByteView view;
+	size_t pos = 0;
+	bool overrun = false;
+
+	ByteReader(ByteView view, size_t pos = 0) : view(view), pos(pos) {}
+
+	bool canRead(size_t count) const { return view.contains(pos, count); }
+	void seek(size_t newPos) { pos = newPos; }
+	void skip(size_t count) { pos += count; }
+
+	void align(size_t alignment)
+	{
+		size_t const offset = pos % alignment;
+		if (offset != 0)
+		{
+			pos += alignment-offset;
+		}
+	}
+
+	// returns a pointer to the next `count` bytes and advances past them, or nullptr if they're out of bounds
+	uint8_t const* take(size_t count)
+	{
+		if (!canRead(count))
+		{
+			overrun = true;
+			pos += count;
+			return nullptr;
+		}
+		uint8_t const* ptr = view.data+pos;
+		pos += count;
+		return ptr;
+	}
+
+	template<typename T> T read()
+	{
+		T value;
+		uint8_t const* ptr = take(sizeof(T));
+		if (ptr)
+			memcpy(&value, ptr, sizeof(T));
+		else
+			memset(&value, 0, sizeof(T));
+		return value;
+	}
+
+	// returns an empty vector if the array is out of bounds
+	template<typename T> std::vector<T> readArray(size_t count)
+	{
+		std::vector<T> vec;
+		uint8_t const* ptr = take(count*sizeof(T));
+		if (ptr && count > 0)
+		{
+			vec.resize(count);
+			memcpy(vec.data(), ptr, count*sizeof(T));
+		}
+		return vec;
+	}
+
+	uint8_t readU8() { return read<uint8_t>(); }
+	uint16_t readU16() { return read<uint16_t>(); }
+	uint32_t readU32() { return read<uint32_t>(); }
+};
+
+
+// a read-only memory mapping of a whole file.
+// falls back to reading the file into memory if it can't be mapped.
+struct MappedFile {
+	enum class Access {
+		Normal,
+		Sequential, // one forward pass, e.g. scanning for banks
+		Random,     // seeking around, e.g. following row offsets
+		WillNeed,   // prefetch the given range
+	};
+
+	MappedFile(char const* path);
+	~MappedFile();
+
+	MappedFile(MappedFile const&) = delete;
+	MappedFile& operator=(MappedFile const&) = delete;
+
+	bool isOpen() const { return opened; }
+	ByteView view() const { return ByteView(data, size); }
+
+	// a hint to the kernel about how we're about to read the given range
+	void advise(Access access, size_t offset = 0, size_t length = SIZE_MAX) const;
+
+private:
+	uint8_t const* data = nullptr;
+	size_t size = 0;
+	bool opened = false;
+	bool mapped = false;
+	std::vector<uint8_t> buffer;
+};
+
+
+// enough to tell whether a file has changed since it was last looked at, without reading it
+struct FileStamp {
+	uint64_t size = 0;
+	int64_t mtimeNanoseconds = 0;
+
+	bool operator==(FileStamp const& other) const
+	{
+		return size == other.size && mtimeNanoseconds == other.mtimeNanoseconds;
+	}
+	bool operator!=(FileStamp const& other) const { return !(*this == other); }
+};
+
+// returns false if the file doesn't exist or isn't a regular file
+bool tryStatFile(char const* path, FileStamp* stamp);
@@ -1,15 +1,14 @@
 #include <cstring>
+#include <algorithm>
+#include <thread>
+#include <fmt/core.h>
 #include "misc.h"
 
-void falign(FILE* fh, size_t align)
-{
-	size_t const pos = ftell(fh);
-	size_t const offset = pos % align;
-	if (offset != 0)
-	{
-		fseek(fh, align-offset, SEEK_CUR);
-	}
-}
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+std::atomic<uint64_t> gCounters[int(Counter::Count)];
 
 bool tryParseHex(char const* str, int digits, int64_t* result)
 {
@@ -72,3 +71,56 @@ bool tryParseNumber(char const* str, int64_t* result)
 		return tryParseDecimal(str, strlen(str), result);
 	}
 }
+
+bool tryParseThreadCount(char const* str, int* result)
+{
+	int64_t count = 0;
+	if (!tryParseNumber(str, &count) || count < 0 || count > 1024)
+	{
+		return false;
+	}
+	if (count == 0)
+	{
+		count = std::max(1u, std::thread::hardware_concurrency());
+	}
+	*result = int(count);
+	return true;
+}
+
+uint64_t peakResidentBytes()
+{
+#if !defined(_WIN32)
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#if defined(__APPLE__)
+	return uint64_t(usage.ru_maxrss);
+#else
+	// linux and the bsds report it in kilobytes
+	return uint64_t(usage.ru_maxrss)*1024;
+#endif
+#else
+	return 0;
+#endif
+}
+
+void printCounters(FILE* fh)
+{
+	char const* const names[] = {
+		"bytes touched",
+		"discontiguous reads",
+		"rows decoded",
+		"zero rows skipped",
+		"cells materialized",
+		"samples copied",
+		"bytes written",
+	};
+	static_assert(sizeof(names)/sizeof(names[0]) == size_t(Counter::Count), "every counter needs a name");
+
+	fmt::print(fh, "stats:\n");
+	for (int counter = 0; counter < int(Counter::Count); ++counter)
+	{
+		fmt::print(fh, "\t{:<20} {:>14}\n", names[counter], countGet(Counter(counter)));
+	}
+	fmt::print(fh, "\t{:<20} {:>14}\n", "peak rss", peakResidentBytes());
+}
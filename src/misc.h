@@ -1,12 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <cstdio>
 #include <cstdint>
 #include <tuple>
 #include <vector>
 
-void falign(FILE* fh, size_t align);
-
 template<typename T> T read(FILE* fh)
 {
 	T value;
@@ -44,3 +43,37 @@ inline uint32_t readU32(FILE* fh) { return read<uint32_t>(fh); }
 bool tryParseHex(char const* str, int digits, int64_t* result);
 bool tryParseDecimal(char const* str, int digits, int64_t* result);
 bool tryParseNumber(char const* str, int64_t* result);
+
+// parses the argument to -j; zero means one thread per core
+bool tryParseThreadCount(char const* str, int* result);
+
+// process-wide counters of how much work a run did, for --stats.
+// they're bumped once per unit of work (a song, a row, a chunk of rom) rather than per byte, so they're always on.
+enum class Counter {
+	BytesTouched,       // input bytes looked at through the mapping, including roms hashed or scanned; not syscalls
+	DiscontiguousReads, // accesses that don't follow on from the previous one, a rough proxy for page faults
+	RowsDecoded,        // packed rows decoded; repeated references to a row are served from the cache
+	ZeroRowsSkipped,    // rows stored as a zero offset, which are empty without being read
+	CellsMaterialized,  // cells filled in across every decoded pattern
+	SamplesCopied,      // sample bytes copied out of the rom, into a bank or an xm
+	BytesWritten,       // xm files and snapshots
+	Count,
+};
+
+extern std::atomic<uint64_t> gCounters[int(Counter::Count)];
+
+inline void countAdd(Counter counter, uint64_t amount)
+{
+	gCounters[int(counter)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+inline uint64_t countGet(Counter counter)
+{
+	return gCounters[int(counter)].load(std::memory_order_relaxed);
+}
+
+// the most memory the process has had resident at once, or zero if the platform won't say
+uint64_t peakResidentBytes();
+
+// every counter, plus the peak rss
+void printCounters(FILE* fh);
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cstring>
+#include "row-decode.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define ESGBA_ROW_DECODE_BMI2 1
+#endif
+
+// the decoders treat a row of cells as a flat run of bytes, where bit N of the bitmask fills byte N
+static_assert(sizeof(SharedCell) == 5, "SharedCell must be exactly five bytes");
+
+namespace
+{
+	int const kMaxBitmaskLength = (255*5+7)/8;
+
+	struct BitPositionTable {
+		// for each possible bitmask byte, the set bits as byte offsets in MSB-first order
+		uint8_t counts[256];
+		uint8_t positions[256][8];
+
+		// for each possible bitmask byte, a mask with 0xff in every byte whose bit is set
+		uint64_t spreads[256];
+
+		BitPositionTable()
+		{
+			for (int bits = 0; bits < 256; ++bits)
+			{
+				counts[bits] = 0;
+				spreads[bits] = 0;
+				for (int i = 0; i < 8; ++i)
+				{
+					if (bits & (0x80>>i))
+					{
+						positions[bits][counts[bits]++] = i;
+						spreads[bits] |= uint64_t(0xff) << (i*8);
+					}
+				}
+			}
+		}
+	};
+	BitPositionTable const kBitPositions;
+
+	size_t bitmaskLength(int channelCount)
+	{
+		return ((channelCount*5)+7)/8;
+	}
+
+	// the bits after the last channel's fields are just padding, and never consume a data byte
+	uint8_t bitmaskByte(uint8_t const* bitmask, size_t index, size_t length, int channelCount)
+	{
+		int const usedBitsInLastByte = (channelCount*5) % 8;
+		if (index == length-1 && usedBitsInLastByte != 0)
+			return bitmask[index] & uint8_t(0xff00 >> usedBitsInLastByte);
+		return bitmask[index];
+	}
+
+	// whether the bitmask and all of the data bytes it calls for lie within `available`
+	bool rowFits(uint8_t const* packed, size_t available, int channelCount)
+	{
+		size_t const length = bitmaskLength(channelCount);
+		if (available < length)
+			return false;
+
+		size_t dataLength = 0;
+		for (size_t i = 0; i < length; ++i)
+			dataLength += kBitPositions.counts[bitmaskByte(packed, i, length, channelCount)];
+		return dataLength <= available-length;
+	}
+
+	template<int kChannelCount>
+	bool decodeLUT(uint8_t const* packed, size_t available, int dynamicChannelCount, SharedCell* cells)
+	{
+		int const channelCount = kChannelCount ? kChannelCount : dynamicChannelCount;
+		if (!rowFits(packed, available, channelCount))
+			return decodeRowReference(packed, available, channelCount, cells);
+
+		size_t const length = bitmaskLength(channelCount);
+		uint8_t const* data = packed+length;
+		uint8_t* out = reinterpret_cast<uint8_t*>(cells);
+		memset(out, 0, channelCount*5);
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			uint8_t const bits = bitmaskByte(packed, i, length, channelCount);
+			uint8_t const count = kBitPositions.counts[bits];
+			uint8_t const* positions = kBitPositions.positions[bits];
+			for (int j = 0; j < count; ++j)
+			{
+				out[i*8 + positions[j]] = data[j];
+			}
+			data += count;
+		}
+		return true;
+	}
+
+#if ESGBA_ROW_DECODE_BMI2
+	template<int kChannelCount>
+	__attribute__((target("bmi2,popcnt")))
+	bool decodeBMI2(uint8_t const* packed, size_t available, int dynamicChannelCount, SharedCell* cells)
+	{
+		int const channelCount = kChannelCount ? kChannelCount : dynamicChannelCount;
+		if (!rowFits(packed, available, channelCount))
+			return decodeRowReference(packed, available, channelCount, cells);
+
+		size_t const length = bitmaskLength(channelCount);
+		uint8_t const* data = packed+length;
+		uint8_t const* dataEnd = packed+available;
+
+		// each bitmask byte scatters up to eight data bytes into eight output bytes.
+		// the last group can spill past the final channel, so go via a scratch buffer.
+		uint8_t scratch[kMaxBitmaskLength*8];
+
+		for (size_t i = 0; i < length; ++i)
+		{
+			uint8_t const bits = bitmaskByte(packed, i, length, channelCount);
+
+			uint64_t chunk = 0;
+			memcpy(&chunk, data, (dataEnd-data >= 8) ? 8 : (dataEnd-data));
+
+			uint64_t const scattered = _pdep_u64(chunk, kBitPositions.spreads[bits]);
+			memcpy(scratch + i*8, &scattered, 8);
+
+			data += _mm_popcnt_u32(bits);
+		}
+
+		memcpy(cells, scratch, channelCount*5);
+		return true;
+	}
+#endif
+}
+
+size_t encodeRow(SharedCell const* cells, int channelCount, uint8_t* packed)
+{
+	size_t const length = bitmaskLength(channelCount);
+	memset(packed, 0, length);
+
+	uint8_t const* fields = reinterpret_cast<uint8_t const*>(cells);
+	uint8_t* data = packed+length;
+	for (int bit = 0; bit < channelCount*5; ++bit)
+	{
+		if (fields[bit])
+		{
+			packed[bit/8] |= uint8_t(0x80 >> (bit%8));
+			*data++ = fields[bit];
+		}
+	}
+	return size_t(data-packed);
+}
+
+size_t packedRowSize(uint8_t const* packed, size_t available, int channelCount)
+{
+	size_t const length = bitmaskLength(channelCount);
+	if (available < length)
+		return available;
+
+	size_t dataLength = 0;
+	for (size_t i = 0; i < length; ++i)
+		dataLength += kBitPositions.counts[bitmaskByte(packed, i, length, channelCount)];
+	return std::min(length+dataLength, available);
+}
+
+bool decodeRowReference(uint8_t const* packed, size_t available, int channelCount, SharedCell* cells)
+{
+	size_t const length = bitmaskLength(channelCount);
+
+	for (int channel = 0; channel < channelCount; ++channel)
+	{
+		cells[channel] = SharedCell();
+	}
+
+	if (available < length)
+		return false;
+
+	uint8_t const* bitmask = packed;
+	size_t pos = length;
+	bool overrun = false;
+
+	auto readU8 = [&]() -> uint8_t {
+		if (pos >= available)
+		{
+			overrun = true;
+			return 0;
+		}
+		return packed[pos++];
+	};
+
+	for (int channel = 0; channel < channelCount; ++channel)
+	{
+		SharedCell& cell = cells[channel];
+
+		int const bitPosNote       = channel*5+0;
+		int const bitPosInstrument = channel*5+1;
+		int const bitPosVolume     = channel*5+2;
+		int const bitPosEffect     = channel*5+3;
+		int const bitPosParam      = channel*5+4;
+
+		if (bitmask[bitPosNote/8] & (0x80>>(bitPosNote%8)))
+		{
+			cell.note = readU8();
+		}
+		if (bitmask[bitPosInstrument/8] & (0x80>>(bitPosInstrument%8)))
+		{
+			cell.inst = readU8();
+		}
+		if (bitmask[bitPosVolume/8] & (0x80>>(bitPosVolume%8)))
+		{
+			cell.vol = readU8();
+		}
+		if (bitmask[bitPosEffect/8] & (0x80>>(bitPosEffect%8)))
+		{
+			cell.effect = readU8();
+		}
+		if (bitmask[bitPosParam/8] & (0x80>>(bitPosParam%8)))
+		{
+			cell.param = readU8();
+		}
+	}
+
+	return !overrun;
+}
+
+bool decodeRowLUT(uint8_t const* packed, size_t available, int channelCount, SharedCell* cells)
+{
+	switch (channelCount)
+	{
+		case 4: return decodeLUT<4>(packed, available, channelCount, cells);
+		case 6: return decodeLUT<6>(packed, available, channelCount, cells);
+		case 8: return decodeLUT<8>(packed, available, channelCount, cells);
+		default: return decodeLUT<0>(packed, available, channelCount, cells);
+	}
+}
+
+bool decodeRowBMI2(uint8_t const* packed, size_t available, int channelCount, SharedCell* cells)
+{
+#if ESGBA_ROW_DECODE_BMI2
+	switch (channelCount)
+	{
+		case 4: return decodeBMI2<4>(packed, available, channelCount, cells);
+		case 6: return decodeBMI2<6>(packed, available, channelCount, cells);
+		case 8: return decodeBMI2<8>(packed, available, channelCount, cells);
+		default: return decodeBMI2<0>(packed, available, channelCount, cells);
+	}
+#else
+	return decodeRowLUT(packed, available, channelCount, cells);
+#endif
+}
+
+bool cpuSupportsBMI2()
+{
+#if ESGBA_ROW_DECODE_BMI2
+	return __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt");
+#else
+	return false;
+#endif
+}
+
+RowDecoder bestRowDecoder()
+{
+	return cpuSupportsBMI2() ? decodeRowBMI2 : decodeRowLUT;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "common.h"
+
+// decoders for the packed row format described in the readme: a bitmask with one bit per field,
+// followed by a byte for each set bit. every field of `cells` is overwritten, and absent fields become zero.
+// each returns false if the row runs past `available` bytes, in which case the missing bytes read as zero.
+typedef bool (*RowDecoder)(uint8_t const* packed, size_t available, int channelCount, SharedCell* cells);
+
+// the straightforward bit-at-a-time loop; everything else must match it
+bool decodeRowReference(uint8_t const* packed, size_t available, int channelCount, SharedCell* cells);
+
+// walks the bitmask a byte at a time, using a table of set bit positions
+bool decodeRowLUT(uint8_t const* packed, size_t available, int channelCount, SharedCell* cells);
+
+// scatters eight data bytes at a time with pdep. only call this if cpuSupportsBMI2() is true.
+bool decodeRowBMI2(uint8_t const* packed, size_t available, int channelCount, SharedCell* cells);
+
+bool cpuSupportsBMI2();
+
+// the inverse of the decoders: packs a row, setting a bit for every non-zero field.
+// `packed` needs room for packedRowCapacity(channelCount) bytes. returns how many were written.
+size_t encodeRow(SharedCell const* cells, int channelCount, uint8_t* packed);
+
+inline size_t packedRowCapacity(int channelCount)
+{
+	return ((channelCount*5)+7)/8 + channelCount*5;
+}
+
+// how many bytes a packed row takes up, bitmask included, capped at `available`
+size_t packedRowSize(uint8_t const* packed, size_t available, int channelCount);
+
+// the fastest decoder this cpu supports
+RowDecoder bestRowDecoder();
+
+inline bool decodeRow(uint8_t const* packed, size_t available, int channelCount, SharedCell* cells)
+{
+	static RowDecoder const decoder = bestRowDecoder();
+	return decoder(packed, available, channelCount, cells);
+}
@@ -0,0 +1,197 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <unordered_set>
+#include <fmt/core.h>
+#include "scan-index.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+// the index is plain text, one record per line:
+//
+//	esgba-index 1
+//	scan <hash> <bank count>
+//	bank <address> <version> <instrument count> <song count>   (bank count of these follow each scan)
+//	file <hash> <size> <mtime in ns> <path, to the end of the line>
+namespace
+{
+	char const* const kIndexMagic = "esgba-index 1";
+
+	bool readLine(FILE* fh, std::string& line)
+	{
+		line.clear();
+		int c;
+		while ((c = fgetc(fh)) != EOF && c != '\n')
+		{
+			line += char(c);
+		}
+		return c != EOF || !line.empty();
+	}
+
+	bool parseIndex(FILE* fh, ScanIndex& index)
+	{
+		std::string line;
+		if (!readLine(fh, line) || line != kIndexMagic)
+			return false;
+
+		std::vector<FoundBank>* currentScan = nullptr;
+		size_t banksExpected = 0;
+		while (readLine(fh, line))
+		{
+			uint64_t hash = 0, size = 0;
+			int64_t mtime = 0;
+			unsigned address = 0, version = 0, instrumentCount = 0, songCount = 0, bankCount = 0;
+			int pathOffset = 0;
+
+			if (sscanf(line.c_str(), "scan %" SCNx64 " %u", &hash, &bankCount) == 2)
+			{
+				currentScan = &index.scans[hash];
+				currentScan->clear();
+				banksExpected = bankCount;
+			}
+			else if (sscanf(line.c_str(), "bank %x %x %u %u", &address, &version, &instrumentCount, &songCount) == 4)
+			{
+				if (!currentScan || banksExpected == 0)
+					return false;
+
+				FoundBank bank;
+				bank.address = address;
+				bank.header.version = uint16_t(version);
+				bank.header.instrumentCount = uint8_t(instrumentCount);
+				bank.header.songCount = uint8_t(songCount);
+				currentScan->push_back(bank);
+				banksExpected--;
+			}
+			else if (sscanf(line.c_str(), "file %" SCNx64 " %" SCNu64 " %" SCNd64 " %n", &hash, &size, &mtime, &pathOffset) == 3 && pathOffset > 0)
+			{
+				ScanIndex::FileEntry& entry = index.files[line.substr(pathOffset)];
+				entry.hash = hash;
+				entry.stamp.size = size;
+				entry.stamp.mtimeNanoseconds = mtime;
+			}
+			else if (!line.empty())
+			{
+				return false;
+			}
+		}
+		return banksExpected == 0;
+	}
+
+	bool writeIndex(FILE* fh, ScanIndex const& index)
+	{
+		fmt::print(fh, "{}\n", kIndexMagic);
+		for (auto const& [hash, banks] : index.scans)
+		{
+			fmt::print(fh, "scan {:016x} {}\n", hash, banks.size());
+			for (FoundBank const& bank : banks)
+			{
+				fmt::print(fh, "bank {:06x} {:04x} {} {}\n", bank.address, bank.header.version, bank.header.instrumentCount, bank.header.songCount);
+			}
+		}
+		for (auto const& [path, entry] : index.files)
+		{
+			fmt::print(fh, "file {:016x} {} {} {}\n", entry.hash, entry.stamp.size, entry.stamp.mtimeNanoseconds, path);
+		}
+		return !ferror(fh);
+	}
+}
+
+bool ScanIndex::load(char const* indexPath)
+{
+	FILE* fh = fopen(indexPath, "rb");
+	if (!fh)
+		return false;
+
+	ScanIndex loaded;
+	bool const ok = parseIndex(fh, loaded);
+	fclose(fh);
+
+	if (ok)
+		*this = std::move(loaded);
+	return ok;
+}
+
+bool ScanIndex::tryFindUnchanged(std::string const& path, FileStamp const& stamp, uint64_t* hash) const
+{
+	auto const file = this->files.find(path);
+	if (file == this->files.end() || file->second.stamp != stamp)
+		return false;
+	if (this->scans.find(file->second.hash) == this->scans.end())
+		return false;
+
+	*hash = file->second.hash;
+	return true;
+}
+
+void ScanIndex::merge(ScanIndex const& other)
+{
+	for (auto const& [hash, banks] : other.scans)
+	{
+		this->scans[hash] = banks;
+	}
+	for (auto const& [path, entry] : other.files)
+	{
+		this->files[path] = entry;
+	}
+}
+
+void ScanIndex::pruneScans()
+{
+	std::unordered_set<uint64_t> referenced;
+	for (auto const& [path, entry] : this->files)
+	{
+		referenced.insert(entry.hash);
+	}
+	for (auto scan = this->scans.begin(); scan != this->scans.end(); )
+	{
+		if (referenced.count(scan->first) == 0)
+			scan = this->scans.erase(scan);
+		else
+			++scan;
+	}
+}
+
+bool ScanIndex::update(char const* indexPath, ScanIndex const& updates, bool replace)
+{
+	std::string const tempPath = fmt::format("{}.tmp", indexPath);
+
+#if !defined(_WIN32)
+	std::string const lockPath = fmt::format("{}.lock", indexPath);
+
+	// hold the lock across the read-merge-write, so concurrent updates don't lose each other's entries
+	int const lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+	if (lockFd < 0 || flock(lockFd, LOCK_EX) != 0)
+	{
+		if (lockFd >= 0)
+			close(lockFd);
+		return false;
+	}
+#endif
+
+	ScanIndex merged;
+	if (!replace)
+		merged.load(indexPath);
+	merged.merge(updates);
+	merged.pruneScans();
+
+	bool ok = false;
+	FILE* fh = fopen(tempPath.c_str(), "wb");
+	if (fh)
+	{
+		ok = writeIndex(fh, merged);
+		ok &= (fclose(fh) == 0);
+		ok = ok && (rename(tempPath.c_str(), indexPath) == 0);
+		if (!ok)
+			remove(tempPath.c_str());
+	}
+
+#if !defined(_WIN32)
+	flock(lockFd, LOCK_UN);
+	close(lockFd);
+#endif
+	return ok;
+}
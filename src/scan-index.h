@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "bank-scan.h"
+#include "mapped-file.h"
+
+// what gbafind has already found, so unchanged roms don't need scanning again.
+// scan results are keyed by the rom's content hash, and each path remembers what its file hashed to,
+// so an unchanged file isn't even read, and a moved or copied rom only needs hashing.
+struct ScanIndex {
+	struct FileEntry {
+		FileStamp stamp;
+		uint64_t hash;
+	};
+
+	std::unordered_map<uint64_t, std::vector<FoundBank>> scans;
+	std::unordered_map<std::string, FileEntry> files;
+
+	// returns false if the index doesn't exist or isn't one, leaving this empty
+	bool load(char const* indexPath);
+
+	// the content hash of the file at `path`, if it hasn't changed since it was indexed
+	bool tryFindUnchanged(std::string const& path, FileStamp const& stamp, uint64_t* hash) const;
+
+	void merge(ScanIndex const& other);
+
+	// drops scan results that no file hashes to any more, e.g. after a rom has changed
+	void pruneScans();
+
+	// merges `updates` into the index on disk, or replaces it outright if `replace` is set.
+	// safe against other processes doing the same at once: updates are serialized with a lock file,
+	// and the index is swapped in with a rename, so readers never see a partly written one.
+	static bool update(char const* indexPath, ScanIndex const& updates, bool replace);
+};
@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <cstring>
+#include <fmt/core.h>
+#include "tar-archive.h"
+
+namespace
+{
+	struct ustar_header_t {
+		char name[100];
+		char mode[8];
+		char uid[8];
+		char gid[8];
+		char size[12];
+		char mtime[12];
+		char checksum[8];
+		char typeflag;
+		char linkname[100];
+		char magic[6];
+		char version[2];
+		char uname[32];
+		char gname[32];
+		char devmajor[8];
+		char devminor[8];
+		char prefix[155];
+		char padding[12];
+	};
+	static_assert(sizeof(ustar_header_t) == kTarBlockSize);
+
+	// numeric fields are zero-padded octal, filling all but the last byte of the field, which is left as a terminator
+	template<size_t N> void putOctal(char (&field)[N], uint64_t value)
+	{
+		std::string const digits = fmt::format("{:0{}o}", value, N-1);
+		memcpy(field, digits.data(), N-1);
+	}
+
+	template<size_t N> void putString(char (&field)[N], std::string const& value)
+	{
+		memcpy(field, value.data(), std::min(value.size(), N));
+	}
+}
+
+bool makeTarHeader(std::string const& name, uint64_t size, int64_t mtime, uint8_t* out)
+{
+	ustar_header_t header;
+	memset(&header, 0, sizeof(header));
+
+	// names longer than the name field are split at a slash, with the directories going in the prefix
+	if (name.size() <= sizeof(header.name))
+	{
+		putString(header.name, name);
+	}
+	else
+	{
+		size_t const slash = name.rfind('/', sizeof(header.prefix));
+		if (slash == std::string::npos || slash == 0 || name.size()-slash-1 > sizeof(header.name))
+			return false;
+		putString(header.prefix, name.substr(0, slash));
+		putString(header.name, name.substr(slash+1));
+	}
+
+	// 11 octal digits only go up to 8GB
+	if (size >= (uint64_t(1) << 33))
+		return false;
+
+	putOctal(header.mode, 0644);
+	putOctal(header.uid, 0);
+	putOctal(header.gid, 0);
+	putOctal(header.size, size);
+	putOctal(header.mtime, uint64_t(std::max<int64_t>(mtime, 0)));
+	header.typeflag = '0';
+	memcpy(header.magic, "ustar", 6);
+	memcpy(header.version, "00", 2);
+
+	// the checksum is taken with its own field as spaces, then stored as six digits, a nul and a space
+	memset(header.checksum, ' ', sizeof(header.checksum));
+	unsigned checksum = 0;
+	for (size_t i = 0; i < sizeof(header); ++i)
+		checksum += reinterpret_cast<uint8_t const*>(&header)[i];
+	std::string const digits = fmt::format("{:06o}", checksum);
+	memcpy(header.checksum, digits.data(), 6);
+	header.checksum[6] = '\0';
+
+	memcpy(out, &header, sizeof(header));
+	return true;
+}
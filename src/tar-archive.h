@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// just enough of the ustar format to write archives of plain files, which any tar can then read.
+// each file is a header block, then its data padded out to a whole number of blocks,
+// and the archive ends with two empty blocks.
+
+size_t const kTarBlockSize = 512;
+size_t const kTarEndSize = 2*kTarBlockSize;
+
+// the file's data rounded up to whole blocks
+inline size_t tarPaddedSize(uint64_t size)
+{
+	return size_t((size + kTarBlockSize-1) / kTarBlockSize * kTarBlockSize);
+}
+
+// fills in a header block for a regular file. returns false if the name is too long to be stored.
+// `mtime` is in seconds since the epoch.
+bool makeTarHeader(std::string const& name, uint64_t size, int64_t mtime, uint8_t* header);
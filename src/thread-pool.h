@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// runs fn(index) for every index in [0,count), spread across up to threadCount threads.
+// indices are handed out in ascending order, so early results tend to finish first.
+template<typename F> void parallelFor(size_t count, int threadCount, F&& fn)
+{
+	size_t const workerCount = std::min<size_t>(std::max(threadCount, 1), count);
+	if (workerCount <= 1)
+	{
+		for (size_t i = 0; i < count; ++i)
+			fn(i);
+		return;
+	}
+
+	std::atomic<size_t> nextIndex(0);
+	auto worker = [&]() {
+		for (size_t i = nextIndex++; i < count; i = nextIndex++)
+			fn(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < workerCount; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+
+// collects text produced out of order by parallel work,
+// and writes it out in index order as soon as each prefix is complete.
+struct OrderedOutput {
+	OrderedOutput(size_t count, FILE* fh)
+		: fh(fh), pending(count), ready(count, false)
+	{
+	}
+
+	void submit(size_t index, std::string text)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->pending[index] = std::move(text);
+		this->ready[index] = true;
+		while (this->nextToWrite < this->ready.size() && this->ready[this->nextToWrite])
+		{
+			std::string& item = this->pending[this->nextToWrite];
+			fwrite(item.data(), 1, item.size(), this->fh);
+			item = std::string();
+			this->nextToWrite++;
+		}
+		fflush(this->fh);
+	}
+
+private:
+	FILE* fh;
+	std::mutex mutex;
+	std::vector<std::string> pending;
+	std::vector<bool> ready;
+	size_t nextToWrite = 0;
+};
+
+
+// hands items from producers to consumers, making producers wait while it's full,
+// so a producer that gets ahead doesn't hold more than `capacity` items in memory.
+template<typename T> struct BoundedQueue {
+	explicit BoundedQueue(size_t capacity)
+		: capacity(std::max<size_t>(capacity, 1))
+	{
+	}
+
+	void push(T item)
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->notFull.wait(lock, [&]() { return this->items.size() < this->capacity; });
+		this->items.push_back(std::move(item));
+		this->notEmpty.notify_one();
+	}
+
+	// no more items are coming; consumers finish off what's left, then get nothing
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->closed = true;
+		this->notEmpty.notify_all();
+	}
+
+	// waits for the next item, or returns nothing once the queue is closed and empty
+	std::optional<T> pop()
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->notEmpty.wait(lock, [&]() { return !this->items.empty() || this->closed; });
+		if (this->items.empty())
+			return std::nullopt;
+
+		std::optional<T> item(std::move(this->items.front()));
+		this->items.pop_front();
+		this->notFull.notify_one();
+		return item;
+	}
+
+private:
+	size_t capacity;
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	std::deque<T> items;
+	bool closed = false;
+};
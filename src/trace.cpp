@@ -0,0 +1,103 @@
+#include "trace.h"
+
+#if ESGBA_TRACING
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fmt/core.h>
+
+std::atomic<bool> gTraceEnabled(false);
+
+namespace
+{
+	struct TraceEvent {
+		char const* name;
+		char const* argName;
+		int64_t argValue;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point end;
+	};
+
+	// each thread appends to its own buffer, so recording never contends.
+	// the buffers are owned here rather than by the threads, so they outlive the worker threads that filled them.
+	struct ThreadBuffer {
+		int threadId;
+		std::vector<TraceEvent> events;
+	};
+
+	std::mutex gBuffersMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> gBuffers;
+	std::chrono::steady_clock::time_point gTraceStart;
+
+	ThreadBuffer& threadBuffer()
+	{
+		thread_local ThreadBuffer* buffer = nullptr;
+		if (!buffer)
+		{
+			std::lock_guard<std::mutex> lock(gBuffersMutex);
+			gBuffers.push_back(std::make_unique<ThreadBuffer>());
+			buffer = gBuffers.back().get();
+			buffer->threadId = int(gBuffers.size());
+		}
+		return *buffer;
+	}
+
+	double microsecondsSinceStart(std::chrono::steady_clock::time_point time)
+	{
+		return std::chrono::duration<double, std::micro>(time - gTraceStart).count();
+	}
+}
+
+bool traceStart()
+{
+	// make sure the calling thread, presumably the main one, is the first thread listed
+	threadBuffer();
+
+	gTraceStart = std::chrono::steady_clock::now();
+	gTraceEnabled = true;
+	return true;
+}
+
+void TraceScope::finish()
+{
+	threadBuffer().events.push_back({ this->name, this->argName, this->argValue, this->start, std::chrono::steady_clock::now() });
+}
+
+bool traceWrite(char const* path)
+{
+	FILE* fh = fopen(path, "w");
+	if (!fh)
+		return false;
+
+	std::lock_guard<std::mutex> lock(gBuffersMutex);
+
+	fmt::print(fh, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (std::unique_ptr<ThreadBuffer> const& buffer : gBuffers)
+	{
+		fmt::print(fh, "{}{{\"ph\":\"M\",\"pid\":1,\"tid\":{},\"name\":\"thread_name\",\"args\":{{\"name\":\"{}\"}}}}",
+			first ? "" : ",\n",
+			buffer->threadId,
+			buffer->threadId == 1 ? "main" : fmt::format("worker {}", buffer->threadId-1));
+		first = false;
+
+		for (TraceEvent const& event : buffer->events)
+		{
+			fmt::print(fh, ",\n{{\"ph\":\"X\",\"pid\":1,\"tid\":{},\"name\":\"{}\",\"ts\":{:.3f},\"dur\":{:.3f}",
+				buffer->threadId,
+				event.name,
+				microsecondsSinceStart(event.start),
+				std::chrono::duration<double, std::micro>(event.end - event.start).count());
+			if (event.argName)
+				fmt::print(fh, ",\"args\":{{\"{}\":{}}}", event.argName, event.argValue);
+			fmt::print(fh, "}}");
+		}
+	}
+	fmt::print(fh, "\n]}}\n");
+
+	return fclose(fh) == 0;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+// scoped timings, written out in the Chrome trace event format (chrome://tracing, or ui.perfetto.dev).
+// nothing is recorded until traceStart() is called, and building with -Dtracing=false compiles it all out.
+
+#ifndef ESGBA_TRACING
+#define ESGBA_TRACING 1
+#endif
+
+#if ESGBA_TRACING
+
+#include <atomic>
+#include <chrono>
+
+extern std::atomic<bool> gTraceEnabled;
+
+// returns false if tracing isn't available in this build
+bool traceStart();
+
+// writes everything recorded so far. returns false if the file couldn't be written.
+bool traceWrite(char const* path);
+
+// records a complete event covering its own lifetime. `name` and `argName` must be string literals.
+struct TraceScope {
+	TraceScope(char const* name, char const* argName = nullptr, int64_t argValue = 0)
+	{
+		if (gTraceEnabled.load(std::memory_order_relaxed))
+		{
+			this->name = name;
+			this->argName = argName;
+			this->argValue = argValue;
+			this->start = std::chrono::steady_clock::now();
+		}
+	}
+
+	~TraceScope()
+	{
+		if (this->name)
+			finish();
+	}
+
+	TraceScope(TraceScope const&) = delete;
+	TraceScope& operator=(TraceScope const&) = delete;
+
+private:
+	char const* name = nullptr;
+	char const* argName = nullptr;
+	int64_t argValue = 0;
+	std::chrono::steady_clock::time_point start;
+
+	void finish();
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// times the rest of the enclosing scope
+#define TRACE_SCOPE(name) TraceScope const TRACE_CONCAT(traceScope, __LINE__)(name)
+
+// as above, with one named integer attached, such as a song index
+#define TRACE_SCOPE_ARG(name, argName, argValue) TraceScope const TRACE_CONCAT(traceScope, __LINE__)(name, argName, int64_t(argValue))
+
+#else
+
+inline bool traceStart() { return false; }
+inline bool traceWrite(char const*) { return false; }
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SCOPE_ARG(name, argName, argValue) ((void)0)
+
+#endif
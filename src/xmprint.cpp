@@ -39,11 +39,11 @@ int main(int argc, char** argv)
 
 		SharedPattern const& pattern = xm.patterns[patternIndex];
 
-		for (uint32_t rowIndex = 0; rowIndex < pattern.rows.size(); ++rowIndex)
+		for (uint32_t rowIndex = 0; rowIndex < pattern.rowCount(); ++rowIndex)
 		{
 			fmt::print("\t{:02x} |", rowIndex);
 
-			SharedRow const& row = pattern.rows[rowIndex];
+			Span<SharedCell const> const row = pattern.row(rowIndex);
 
 			char const* notes[] = {
 				"C-", "C#", "D-",
@@ -54,7 +54,7 @@ int main(int argc, char** argv)
 
 			for (int i = 0; i < xm.channelCount; ++i)
 			{
-				SharedCell const& cell = row.cells[i];
+				SharedCell const& cell = row[i];
 				uint8_t const note = (cell.note-1);
 				fmt::print(cell.note ? " {}{}" : " ---", notes[note%12], note/12);
 				fmt::print(cell.inst   ? " {:02x}" : " --", cell.inst);